@@ -0,0 +1,86 @@
+#include "cuculiform.h"
+#include "memory_resource.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <vector>
+
+// count every trip to the global allocator to show where malloc is involved
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+  allocations++;
+  void* pointer = std::malloc(size);
+  if (pointer == nullptr) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void operator delete(void* pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+  std::free(pointer);
+}
+
+template <typename Create>
+void run(const char* name, size_t cycles, Create create) {
+  size_t allocations_before = allocations;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t cycle = 0; cycle < cycles; cycle++) {
+    create(cycle);
+  }
+  auto end = std::chrono::steady_clock::now();
+  double elapsed_ns =
+    std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+  std::cout << name << ": " << elapsed_ns / cycles << "ns per cycle, "
+            << static_cast<double>(allocations - allocations_before) / cycles
+            << " global allocations per cycle" << std::endl;
+}
+
+// Create and destroy many short-lived filters, once with the default
+// allocator and once placing them in a monotonic arena that is reset after
+// every cycle.
+int main(int argc, char** argv) {
+  size_t capacity = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1024;
+  size_t cycles = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 100000;
+  size_t fingerprint_size = 2;
+
+  std::cout << "### create/destroy cycles of filters with capacity "
+            << capacity << " ###" << std::endl;
+
+  size_t sizes = 0;
+  run("std::allocator", cycles, [&](size_t cycle) {
+    cuculiform::CuckooFilter<uint64_t, std::allocator<uint8_t>> filter{
+      capacity, fingerprint_size};
+    sizes += filter.size() + cycle;
+  });
+
+  // large enough for bucket array and occupancy bitmaps of one filter
+  std::vector<uint8_t> buffer(2 * capacity * fingerprint_size + 4096);
+  cuculiform::MonotonicBufferResource arena(buffer.data(), buffer.size());
+  using Allocator = cuculiform::ResourceAllocator<uint8_t>;
+  run("monotonic arena", cycles, [&](size_t cycle) {
+    {
+      cuculiform::CuckooFilter<uint64_t, Allocator> filter{
+        capacity,
+        fingerprint_size,
+        500,
+        4,
+        cuculiform::CityHash{},
+        cuculiform::CityHash{},
+        true,
+        Allocator(&arena)};
+      sizes += filter.size() + cycle;
+    }
+    arena.release();
+  });
+
+  // keep the filters from being optimized away
+  return sizes == cycles * (cycles - 1) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,91 @@
+#include "expiring_cuckoo_filter.h"
+#include "windowed_cuckoo_filter.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsed_s(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now()
+                                                               - start)
+           .count()
+         / 1e6;
+}
+
+// Stream items through a sliding horizon of `window` epochs with
+// `per_epoch` items each, querying every item as it arrives like a
+// deduplicator would. Reports throughput, false positive rate on items that
+// are outside of the horizon, and memory.
+template <typename Filter>
+void run(const char* name, Filter& filter, size_t window, size_t per_epoch,
+         size_t epochs) {
+  size_t failed = 0;
+  size_t operations = 0;
+  size_t false_positives = 0;
+  size_t probes = 0;
+  auto start = Clock::now();
+  for (size_t e = 0; e < epochs; e++) {
+    if (e > 0) {
+      filter.advance();
+    }
+    for (size_t i = e * per_epoch; i < (e + 1) * per_epoch; i++) {
+      if (!filter.contains(i)) {
+        failed += !filter.insert(i);
+      }
+      operations += 2;
+    }
+  }
+  double seconds = elapsed_s(start);
+
+  // items of the epochs before the window
+  size_t expired = (epochs - window) * per_epoch;
+  for (size_t i = 0; i < expired; i++) {
+    false_positives += filter.contains(i);
+    probes++;
+  }
+
+  std::cout << name << ": " << operations / seconds / 1e6 << "M ops/s, "
+            << failed << " failed inserts, fpr "
+            << static_cast<double>(false_positives) / probes << ", "
+            << filter.memory_usage() / (1 << 20) << "MiB" << std::endl;
+}
+
+// adapts ExpiringCuckooFilter to the windowed interface
+class Expiring : public cuculiform::ExpiringCuckooFilter<uint64_t> {
+public:
+  using ExpiringCuckooFilter::ExpiringCuckooFilter;
+
+  void advance() {
+    advance_epoch();
+  }
+};
+
+int main(int argc, char** argv) {
+  size_t per_epoch =
+    argc > 1 ? std::strtoull(argv[1], nullptr, 10) : size_t(3) << 18;
+  size_t window = 4;
+  size_t epochs = 16;
+  // both variants at roughly 75% load
+  size_t generation_capacity = per_epoch * 4 / 3;
+
+  std::cout << "### " << window << " epochs of " << per_epoch
+            << " items ###" << std::endl;
+  {
+    cuculiform::WindowedCuckooFilter<uint64_t> filter{generation_capacity,
+                                                      window, 2};
+    run("generations, 16 bit fingerprints", filter, window, per_epoch,
+        epochs);
+  }
+  {
+    // 4 bits for the epoch leave 12 bit fingerprints
+    Expiring filter{window * generation_capacity, 2, window, 4};
+    run("ttl bits,    12 bit fingerprints", filter, window, per_epoch, epochs);
+  }
+  {
+    Expiring filter{window * generation_capacity, 3, window, 4};
+    run("ttl bits,    20 bit fingerprints", filter, window, per_epoch, epochs);
+  }
+  return EXIT_SUCCESS;
+}
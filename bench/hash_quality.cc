@@ -0,0 +1,62 @@
+#include "hash_quality.h"
+
+#include <cstdlib>
+#include <iostream>
+
+// The hash functions of util.h, plus the identity std::hash of integers as
+// a known bad baseline. Add your own here or include hash_quality.h from
+// your own program.
+static std::vector<Hasher> hashers() {
+  return {
+    {"CityHash (seeded)",
+     [](uint64_t seed) -> HashFunction { return cuculiform::CityHash(seed); }},
+    {"HighwayHash (fixed key)",
+     [](uint64_t) -> HashFunction { return cuculiform::HighwayHash(); }},
+    {"TwoIndependentMultiplyShift",
+     [](uint64_t seed) -> HashFunction {
+       return cuculiform::TwoIndependentMultiplyShift(seed);
+     }},
+    {"std::hash (identity)",
+     [](uint64_t) -> HashFunction { return std::hash<size_t>(); }},
+  };
+}
+
+// Arguments: [RUNS] [CAPACITY] [FINGERPRINT_SIZE] [THREADS], defaulting to
+// 256 runs of filters with capacity 65536 and 1 byte fingerprints on all
+// cores.
+int main(int argc, char** argv) {
+  HashQualityConfig config;
+  if (argc > 1) {
+    config.runs = std::strtoull(argv[1], nullptr, 10);
+  }
+  if (argc > 2) {
+    config.capacity = std::strtoull(argv[2], nullptr, 10);
+  }
+  if (argc > 3) {
+    config.fingerprint_size = std::strtoull(argv[3], nullptr, 10);
+  }
+  if (argc > 4) {
+    config.threads = std::strtoull(argv[4], nullptr, 10);
+  }
+  if (config.runs == 0 || config.threads == 0 || config.fingerprint_size == 0
+      || config.fingerprint_size > 4) {
+    std::cerr << "usage: cuculiform_bench_hash_quality [RUNS] [CAPACITY] "
+                 "[FINGERPRINT_SIZE] [THREADS]"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "### " << config.runs << " runs, capacity " << config.capacity
+            << ", " << config.fingerprint_size << " byte fingerprints, "
+            << config.threads << " threads, fpr at "
+            << config.fpr_load * 100 << "% load ###" << std::endl;
+  auto start = std::chrono::steady_clock::now();
+  std::vector<HashQuality> qualities = evaluate_hashers(hashers(), config);
+  write_report(std::cout, qualities);
+  std::cout << "took "
+            << std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                             - start)
+                 .count()
+            << "s" << std::endl;
+  return EXIT_SUCCESS;
+}
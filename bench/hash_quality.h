@@ -0,0 +1,213 @@
+#pragma once
+
+#include "cuculiform.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <ostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Evaluation of hash functions for CuckooFilter: false positive rate,
+// achievable load, relocation effort and raw hashing cost, over many
+// independent runs spread across all cores. Include this to evaluate your
+// own hash function, bench/hash_quality.cc runs the ones of util.h.
+
+using HashFunction = std::function<uint64_t(size_t)>;
+
+struct Hasher {
+  std::string name;
+  // hash function for a seed, hashers without seeds may ignore it
+  std::function<HashFunction(uint64_t seed)> make;
+};
+
+struct HashQualityConfig {
+  size_t runs = 256;
+  size_t capacity = 1 << 16;
+  size_t fingerprint_size = 1;
+  size_t bucket_size = 4;
+  uint max_relocations = 500;
+  // load the false positive rate is measured at, if reached
+  double fpr_load = 0.9;
+  size_t probes = 1 << 16; // lookups of non-members per run
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+};
+
+// result of a single run
+struct HashRun {
+  double false_positive_rate = 0;
+  double load_at_failure = 0; // load before the first failed insert
+  size_t relocations = 0;
+  size_t relocated_inserts = 0; // including the failed one
+  double nanoseconds_per_key = 0;
+};
+
+struct HashQuality {
+  std::string name;
+  double fpr_mean = 0;
+  double fpr_sigma = 0;
+  double fpr_max = 0;
+  double load_mean = 0;
+  double load_min = 0;
+  // kicks per insert that needed any, i.e. the average kick chain length
+  double kick_chain = 0;
+  double nanoseconds_per_key = 0; // median over the runs
+};
+
+// One run on fresh random keys: fill a filter up to the first failed insert,
+// measuring the false positive rate when crossing config.fpr_load, then time
+// hashing the inserted keys.
+inline HashRun evaluate_run(const Hasher& hasher,
+                            const HashQualityConfig& config, uint64_t seed) {
+  HashRun result;
+  cuculiform::CuckooFilter<uint64_t> filter(
+    config.capacity, config.fingerprint_size, config.max_relocations,
+    config.bucket_size, hasher.make(2 * seed + 1), hasher.make(2 * seed + 2));
+  size_t slots =
+    cuculiform::ceil_to_power_of_two(config.capacity / config.bucket_size)
+    * config.bucket_size;
+  std::mt19937_64 gen(seed);
+
+  // random 64 bit keys are distinct with overwhelming probability
+  std::vector<uint64_t> keys;
+  keys.reserve(slots);
+  bool measured = false;
+  auto measure = [&] {
+    std::mt19937_64 probe_gen(~seed);
+    size_t hits = 0;
+    for (size_t i = 0; i < config.probes; i++) {
+      hits += filter.contains(probe_gen());
+    }
+    result.false_positive_rate = static_cast<double>(hits) / config.probes;
+    measured = true;
+  };
+  while (keys.size() < slots) {
+    if (!measured && keys.size() >= config.fpr_load * slots) {
+      measure();
+    }
+    uint64_t key = gen();
+    size_t size = filter.size();
+    if (!filter.insert(key)) {
+      result.load_at_failure = static_cast<double>(size) / slots;
+      break;
+    }
+    keys.push_back(key);
+  }
+  if (keys.size() == slots) {
+    result.load_at_failure = 1;
+  }
+  if (!measured) {
+    measure();
+  }
+  const cuculiform::Statistics& statistics = filter.statistics();
+  result.relocations = statistics.relocations;
+  result.relocated_inserts =
+    statistics.relocated_inserts + statistics.failed_inserts;
+
+  // through std::function, as the filter calls it
+  HashFunction hash = hasher.make(seed);
+  uint64_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t key : keys) {
+    sink ^= hash(key);
+  }
+  auto nanoseconds = std::chrono::duration<double, std::nano>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  // keep the loop from being optimized out
+  result.nanoseconds_per_key =
+    (nanoseconds + (sink == 42 ? 1 : 0)) / std::max<size_t>(keys.size(), 1);
+  return result;
+}
+
+inline HashQuality summarize(const std::string& name,
+                             const std::vector<HashRun>& runs) {
+  HashQuality quality;
+  quality.name = name;
+  quality.load_min = 1;
+  size_t relocations = 0;
+  size_t relocated_inserts = 0;
+  std::vector<double> nanoseconds;
+  for (auto& run : runs) {
+    quality.fpr_mean += run.false_positive_rate / runs.size();
+    quality.fpr_max = std::max(quality.fpr_max, run.false_positive_rate);
+    quality.load_mean += run.load_at_failure / runs.size();
+    quality.load_min = std::min(quality.load_min, run.load_at_failure);
+    relocations += run.relocations;
+    relocated_inserts += run.relocated_inserts;
+    nanoseconds.push_back(run.nanoseconds_per_key);
+  }
+  double squares = 0;
+  for (auto& run : runs) {
+    double deviation = run.false_positive_rate - quality.fpr_mean;
+    squares += deviation * deviation;
+  }
+  quality.fpr_sigma = std::sqrt(squares / runs.size());
+  quality.kick_chain =
+    relocated_inserts == 0
+      ? 0
+      : static_cast<double>(relocations) / relocated_inserts;
+  std::nth_element(nanoseconds.begin(),
+                   nanoseconds.begin() + nanoseconds.size() / 2,
+                   nanoseconds.end());
+  quality.nanoseconds_per_key = nanoseconds[nanoseconds.size() / 2];
+  return quality;
+}
+
+// Run config.runs runs of every hasher on config.threads threads. Run i of
+// every hasher uses seed i, so hashers are compared on the same keys.
+inline std::vector<HashQuality>
+evaluate_hashers(const std::vector<Hasher>& hashers,
+                 const HashQualityConfig& config) {
+  std::vector<std::vector<HashRun>> runs(
+    hashers.size(), std::vector<HashRun>(config.runs));
+  std::atomic<size_t> next(0);
+  size_t jobs = hashers.size() * config.runs;
+  auto work = [&] {
+    for (size_t job = next++; job < jobs; job = next++) {
+      size_t hasher = job % hashers.size();
+      size_t run = job / hashers.size();
+      runs[hasher][run] = evaluate_run(hashers[hasher], config, run);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < config.threads; i++) {
+    threads.emplace_back(work);
+  }
+  work();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::vector<HashQuality> qualities;
+  for (size_t i = 0; i < hashers.size(); i++) {
+    qualities.push_back(summarize(hashers[i].name, runs[i]));
+  }
+  return qualities;
+}
+
+inline void write_report(std::ostream& out,
+                         const std::vector<HashQuality>& qualities) {
+  out << std::left << std::setw(28) << "hasher" << std::right
+      << std::setw(11) << "fpr mean" << std::setw(11) << "fpr sigma"
+      << std::setw(11) << "fpr max" << std::setw(10) << "load avg"
+      << std::setw(10) << "load min" << std::setw(8) << "kicks"
+      << std::setw(9) << "ns/key" << "\n";
+  for (auto& quality : qualities) {
+    out << std::left << std::setw(28) << quality.name << std::right
+        << std::fixed << std::setprecision(6) << std::setw(11)
+        << quality.fpr_mean << std::setw(11) << quality.fpr_sigma
+        << std::setw(11) << quality.fpr_max << std::setprecision(4)
+        << std::setw(10) << quality.load_mean << std::setw(10)
+        << quality.load_min << std::setprecision(2) << std::setw(8)
+        << quality.kick_chain << std::setw(9) << quality.nanoseconds_per_key
+        << "\n";
+  }
+  out.unsetf(std::ios::floatfield);
+}
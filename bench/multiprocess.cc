@@ -0,0 +1,121 @@
+#include "concurrent_cuckoo_filter.h"
+#include "zipf.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+using Filter = cuculiform::ConcurrentCuckooFilter<uint64_t>;
+
+struct Config {
+  size_t keys = 1 << 22;
+  size_t operations = 1 << 21; // per process
+  int insert_percent = 5;
+  int erase_percent = 5; // the rest are lookups
+  size_t fingerprint_size = 2;
+};
+
+// A worker process: attach to the filter by name and run a mix of uniformly
+// distributed operations, returns the seconds taken
+static double run_worker(const std::string& name, const Config& config,
+                         size_t capacity, size_t id) {
+  Filter filter(name, capacity, config.fingerprint_size);
+  std::mt19937_64 gen(id + 1);
+  std::uniform_int_distribution<uint64_t> uniform(0, config.keys - 1);
+  std::uniform_int_distribution<int> percent(0, 99);
+  size_t hits = 0;
+  auto start = Clock::now();
+  for (size_t i = 0; i < config.operations; i++) {
+    uint64_t key = scramble(uniform(gen));
+    int op = percent(gen);
+    if (op < config.insert_percent) {
+      filter.insert(key);
+    } else if (op < config.insert_percent + config.erase_percent) {
+      filter.erase(key);
+    } else {
+      hits += filter.contains(key);
+    }
+  }
+  double seconds =
+    std::chrono::duration<double>(Clock::now() - start).count();
+  return seconds + (hits == size_t(-1) ? 1 : 0);
+}
+
+// Fork worker processes sharing one filter in POSIX shared memory, as a
+// prefork server would, doubling from 1 up to PROCESSES. Arguments:
+// [PROCESSES] [KEYS], defaulting to the number of cores and 4194304 keys,
+// half of which are inserted up front.
+int main(int argc, char** argv) {
+  Config config;
+  size_t max_processes = std::thread::hardware_concurrency();
+  if (argc > 1) {
+    max_processes = std::strtoull(argv[1], nullptr, 10);
+  }
+  if (argc > 2) {
+    config.keys = std::strtoull(argv[2], nullptr, 10);
+  }
+  size_t capacity = config.keys * 2;
+  std::string name = "/cuculiform-bench-" + std::to_string(getpid());
+
+  // seconds per worker, written by the children
+  void* shared =
+    mmap(nullptr, max_processes * sizeof(double), PROT_READ | PROT_WRITE,
+         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    std::cerr << "can't map result memory" << std::endl;
+    return EXIT_FAILURE;
+  }
+  double* seconds = static_cast<double*>(shared);
+
+  std::vector<size_t> process_counts;
+  for (size_t processes = 1; processes < max_processes; processes *= 2) {
+    process_counts.push_back(processes);
+  }
+  process_counts.push_back(max_processes);
+
+  for (size_t processes : process_counts) {
+    Filter::remove(name);
+    Filter filter(name, capacity, config.fingerprint_size);
+    for (uint64_t key = 0; key < config.keys / 2; key++) {
+      filter.insert(scramble(key));
+    }
+    std::vector<pid_t> children;
+    for (size_t id = 0; id < processes; id++) {
+      pid_t child = fork();
+      if (child == 0) {
+        seconds[id] = run_worker(name, config, capacity, id);
+        _exit(EXIT_SUCCESS);
+      }
+      children.push_back(child);
+    }
+    double slowest = 0;
+    for (size_t id = 0; id < processes; id++) {
+      int status = 0;
+      waitpid(children[id], &status, 0);
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        std::cerr << "worker " << id << " failed" << std::endl;
+        Filter::remove(name);
+        return EXIT_FAILURE;
+      }
+      slowest = std::max(slowest, seconds[id]);
+    }
+    std::cout << processes << " processes: "
+              << processes * config.operations / slowest / 1e6
+              << "M ops/s, one shared copy of "
+              << filter.memory_usage() / 1e6 << "MB instead of "
+              << processes * filter.memory_usage() / 1e6 << "MB, load "
+              << filter.load_factor() << std::endl;
+  }
+  Filter::remove(name);
+  munmap(shared, max_processes * sizeof(double));
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,209 @@
+// split insert latencies of CuckooFilter into direct and relocated ones
+#define CUCULIFORM_ENABLE_LATENCY
+
+#include "adaptive_cuckoo_filter.h"
+#include "cuckoo_hash_map.h"
+#include "cuculiform.h"
+#include "trace.h"
+#include "zipf.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+using Clock = std::chrono::steady_clock;
+
+static void usage() {
+  std::cerr
+    << "usage:\n"
+       "  cuculiform_bench_replay generate TRACE [OPS] [KEYS] [THETA]\n"
+       "    Write a synthetic trace: KEYS inserts, then OPS operations of\n"
+       "    which 90% are lookups of Zipfian keys with skew THETA, half of\n"
+       "    them never inserted, 5% inserts of new keys and 5% erases of the\n"
+       "    oldest keys. Defaults: 10000000 1000000 0.99\n"
+       "  cuculiform_bench_replay run TRACE [ENGINE] [CAPACITY] [FP_SIZE]\n"
+       "    Replay TRACE against ENGINE, one of filter (default), adaptive\n"
+       "    or hash_set. CAPACITY defaults to the peak number of live keys\n"
+       "    divided by 0.95, FP_SIZE to 2.\n";
+}
+
+static int generate(const std::string& path, size_t operations, size_t keys,
+                    double theta) {
+  std::ofstream file(path, std::ios::binary);
+  cuculiform::TraceWriter writer(file);
+  std::mt19937_64 gen(42);
+
+  // live keys are the ranks [oldest, next)
+  uint64_t oldest = 0;
+  uint64_t next = keys;
+  for (uint64_t rank = 0; rank < keys; rank++) {
+    writer.record(cuculiform::TraceOp::Insert, scramble(rank));
+  }
+  ZipfDistribution zipf(2 * keys, theta);
+  std::uniform_int_distribution<int> percent(0, 99);
+  for (size_t i = 0; i < operations; i++) {
+    int op = percent(gen);
+    if (op < 90) {
+      // ranks beyond the live keys are lookups of non-members
+      writer.record(cuculiform::TraceOp::Contains,
+                    scramble(oldest + zipf(gen)));
+    } else if (op < 95) {
+      writer.record(cuculiform::TraceOp::Insert, scramble(next++));
+    } else if (oldest < next) {
+      writer.record(cuculiform::TraceOp::Erase, scramble(oldest++));
+    }
+  }
+  writer.flush();
+  std::cout << "wrote " << writer.count() << " records to " << path
+            << std::endl;
+  return file ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+struct Latencies {
+  std::vector<uint32_t> nanoseconds;
+
+  void report(const char* name) {
+    if (nanoseconds.empty()) {
+      return;
+    }
+    std::sort(nanoseconds.begin(), nanoseconds.end());
+    auto percentile = [this](double p) {
+      return nanoseconds[static_cast<size_t>(p * (nanoseconds.size() - 1))];
+    };
+    std::cout << name << " latency ns: p50 " << percentile(0.5) << ", p90 "
+              << percentile(0.9) << ", p99 " << percentile(0.99)
+              << ", p99.9 " << percentile(0.999) << ", max "
+              << nanoseconds.back() << " (" << nanoseconds.size()
+              << " ops)" << std::endl;
+  }
+};
+
+template <typename Engine>
+static bool apply(Engine& engine, const cuculiform::TraceRecord& record) {
+  switch (record.op) {
+    case cuculiform::TraceOp::Insert:
+      return engine.insert(record.key_hash);
+    case cuculiform::TraceOp::Contains:
+      return engine.contains(record.key_hash);
+    default:
+      return engine.erase(record.key_hash);
+  }
+}
+
+// Replay twice on fresh engines: once for throughput, once timing every
+// operation, so timer overhead doesn't distort the throughput.
+template <typename Engine, typename Factory>
+static void replay(const std::vector<cuculiform::TraceRecord>& records,
+                   Factory make_engine) {
+  {
+    cuculiform::latency::set_sample_interval(0);
+    Engine engine = make_engine();
+    size_t results = 0;
+    auto start = Clock::now();
+    for (auto& record : records) {
+      results += apply(engine, record);
+    }
+    double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << records.size() / seconds / 1e6 << "M ops/s (" << results
+              << " true results)" << std::endl;
+  }
+
+  cuculiform::latency::set_sample_interval(1);
+  cuculiform::latency::reset();
+  Engine engine = make_engine();
+  Latencies latencies[3];
+  size_t failed_inserts = 0;
+  size_t hits = 0;
+  for (auto& record : records) {
+    auto start = Clock::now();
+    bool result = apply(engine, record);
+    auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         Clock::now() - start)
+                         .count();
+    latencies[static_cast<size_t>(record.op)].nanoseconds.push_back(
+      static_cast<uint32_t>(nanoseconds));
+    if (record.op == cuculiform::TraceOp::Insert) {
+      failed_inserts += !result;
+    } else if (record.op == cuculiform::TraceOp::Contains) {
+      hits += result;
+    }
+  }
+  latencies[0].report("insert  ");
+  latencies[1].report("contains");
+  latencies[2].report("erase   ");
+  std::cout << failed_inserts << " failed inserts, " << hits
+            << " lookups answered true" << std::endl;
+  cuculiform::latency::Latencies filter_latencies =
+    cuculiform::latency::snapshot();
+  if (filter_latencies[cuculiform::latency::Operation::Contains].count() > 0) {
+    std::cout << "inside the cuckoo filters:\n";
+    filter_latencies.write_text(std::cout);
+  }
+}
+
+static int run(const std::string& path, const std::string& engine,
+               size_t capacity, size_t fingerprint_size) {
+  std::ifstream file(path, std::ios::binary);
+  std::vector<cuculiform::TraceRecord> records = cuculiform::read_trace(file);
+  if (capacity == 0) {
+    size_t live = 0;
+    size_t peak = 0;
+    for (auto& record : records) {
+      if (record.op == cuculiform::TraceOp::Insert) {
+        peak = std::max(peak, ++live);
+      } else if (record.op == cuculiform::TraceOp::Erase && live > 0) {
+        live--;
+      }
+    }
+    capacity = peak * 100 / 95 + 1;
+  }
+  std::cout << "### " << records.size() << " records against " << engine
+            << ", capacity " << capacity << " ###" << std::endl;
+
+  if (engine == "filter") {
+    using Engine = cuculiform::CuckooFilter<uint64_t>;
+    replay<Engine>(records, [&] { return Engine(capacity, fingerprint_size); });
+  } else if (engine == "adaptive") {
+    using Engine = cuculiform::AdaptiveCuckooFilter<uint64_t>;
+    replay<Engine>(records, [&] { return Engine(capacity, fingerprint_size); });
+  } else if (engine == "hash_set") {
+    using Engine = cuculiform::CuckooHashSet<uint64_t>;
+    replay<Engine>(records, [&] { return Engine(capacity); });
+  } else {
+    usage();
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    usage();
+    return EXIT_FAILURE;
+  }
+  std::string command = argv[1];
+  std::string path = argv[2];
+  try {
+    if (command == "generate") {
+      return generate(
+        path, argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 10000000,
+        argc > 4 ? std::strtoull(argv[4], nullptr, 10) : 1000000,
+        argc > 5 ? std::strtod(argv[5], nullptr) : 0.99);
+    }
+    if (command == "run") {
+      return run(path, argc > 3 ? argv[3] : "filter",
+                 argc > 4 ? std::strtoull(argv[4], nullptr, 10) : 0,
+                 argc > 5 ? std::strtoull(argv[5], nullptr, 10) : 2);
+    }
+  } catch (const std::exception& exception) {
+    std::cerr << "cuculiform_bench_replay: " << exception.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+  usage();
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,274 @@
+#include "concurrent_cuckoo_filter.h"
+#include "cuculiform.h"
+#include "zipf.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+// CuckooFilter behind a single mutex, the baseline
+class LockedFilter {
+public:
+  LockedFilter(size_t capacity, size_t fingerprint_size)
+      : m_filter(capacity, fingerprint_size) {
+  }
+
+  bool insert(uint64_t item) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_filter.insert(item);
+  }
+  bool contains(uint64_t item) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_filter.contains(item);
+  }
+  bool erase(uint64_t item) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_filter.erase(item);
+  }
+
+private:
+  std::mutex m_mutex;
+  cuculiform::CuckooFilter<uint64_t> m_filter;
+};
+
+// Items partitioned across independently locked filters by their hash
+class ShardedFilter {
+public:
+  ShardedFilter(size_t capacity, size_t fingerprint_size, size_t shard_bits)
+      : m_shard_bits(shard_bits) {
+    size_t shards = size_t(1) << shard_bits;
+    for (size_t i = 0; i < shards; i++) {
+      m_shards.emplace_back(new Shard(capacity / shards, fingerprint_size));
+    }
+  }
+
+  bool insert(uint64_t item) {
+    Shard& shard = get_shard(item);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.filter.insert(item);
+  }
+  bool contains(uint64_t item) {
+    Shard& shard = get_shard(item);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.filter.contains(item);
+  }
+  bool erase(uint64_t item) {
+    Shard& shard = get_shard(item);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.filter.erase(item);
+  }
+
+private:
+  // shards are allocated one by one, so their locks don't share cache lines
+  struct Shard {
+    Shard(size_t capacity, size_t fingerprint_size)
+        : filter(capacity, fingerprint_size) {
+    }
+    std::mutex mutex;
+    cuculiform::CuckooFilter<uint64_t> filter;
+  };
+
+  size_t m_shard_bits;
+  std::vector<std::unique_ptr<Shard>> m_shards;
+
+  Shard& get_shard(uint64_t item) {
+    // independent of the bits the filters derive buckets from
+    uint64_t hash = item * 0x9E3779B97F4A7C15ull;
+    return *m_shards[m_shard_bits == 0 ? 0 : hash >> (64 - m_shard_bits)];
+  }
+};
+
+// Latencies in power of two buckets of nanoseconds
+struct Log2Histogram {
+  uint64_t counts[64] = {};
+  uint64_t total = 0;
+
+  void record(uint64_t nanoseconds) {
+    counts[nanoseconds == 0 ? 0 : 64 - __builtin_clzll(nanoseconds)]++;
+    total++;
+  }
+  // upper bound of the bucket holding the given percentile
+  uint64_t percentile(double p) const {
+    uint64_t rank = static_cast<uint64_t>(p * total);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < 64; i++) {
+      seen += counts[i];
+      if (seen > rank) {
+        return uint64_t(1) << i;
+      }
+    }
+    return uint64_t(1) << 63;
+  }
+};
+
+struct Config {
+  size_t keys = 1 << 22;
+  size_t operations = 1 << 21; // per thread
+  double theta = 0;            // 0 for uniform keys
+  int insert_percent = 10;
+  int erase_percent = 5; // the rest are lookups
+  size_t fingerprint_size = 2;
+};
+
+struct ThreadResult {
+  double seconds = 0;
+  Log2Histogram latencies;
+};
+
+static void pin_to_cpu(size_t cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu % std::thread::hardware_concurrency(), &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+template <typename Filter>
+static void run_thread(Filter& filter, const Config& config,
+                       ZipfDistribution zipf, size_t id,
+                       std::atomic<size_t>& ready, size_t thread_count,
+                       ThreadResult& result) {
+  pin_to_cpu(id);
+  std::mt19937_64 gen(id + 1);
+  std::uniform_int_distribution<uint64_t> uniform(0, config.keys - 1);
+  std::uniform_int_distribution<int> percent(0, 99);
+
+  // start all threads at once
+  ready++;
+  while (ready.load() < thread_count) {
+    std::this_thread::yield();
+  }
+
+  auto start = Clock::now();
+  for (size_t i = 0; i < config.operations; i++) {
+    uint64_t key = scramble(config.theta > 0 ? zipf(gen) : uniform(gen));
+    int op = percent(gen);
+    // time every 16th operation, timers would dominate otherwise
+    bool sampled = i % 16 == 0;
+    auto op_start = sampled ? Clock::now() : Clock::time_point();
+    if (op < config.insert_percent) {
+      filter.insert(key);
+    } else if (op < config.insert_percent + config.erase_percent) {
+      filter.erase(key);
+    } else {
+      filter.contains(key);
+    }
+    if (sampled) {
+      result.latencies.record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now()
+                                                             - op_start)
+          .count());
+    }
+  }
+  result.seconds =
+    std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+template <typename Filter>
+static void run(const char* name, Filter& filter, const Config& config,
+                const ZipfDistribution& zipf, size_t thread_count) {
+  std::vector<ThreadResult> results(thread_count);
+  std::vector<std::thread> threads;
+  std::atomic<size_t> ready(0);
+  for (size_t id = 0; id < thread_count; id++) {
+    threads.emplace_back(run_thread<Filter>, std::ref(filter),
+                         std::cref(config), zipf, id, std::ref(ready),
+                         thread_count, std::ref(results[id]));
+  }
+  double seconds = 0;
+  for (size_t id = 0; id < thread_count; id++) {
+    threads[id].join();
+    seconds = std::max(seconds, results[id].seconds);
+  }
+
+  std::cout << std::setw(3) << thread_count << " threads " << name << ": "
+            << thread_count * config.operations / seconds / 1e6
+            << "M ops/s" << std::endl;
+  for (size_t id = 0; id < thread_count; id++) {
+    const Log2Histogram& latencies = results[id].latencies;
+    std::cout << "    thread " << id << ": p50 < "
+              << latencies.percentile(0.5) << "ns, p99 < "
+              << latencies.percentile(0.99) << "ns, p99.9 < "
+              << latencies.percentile(0.999) << "ns" << std::endl;
+  }
+}
+
+template <typename Filter>
+static void prefill(Filter& filter, const Config& config) {
+  for (uint64_t key = 0; key < config.keys / 2; key++) {
+    filter.insert(scramble(key));
+  }
+}
+
+// Run every thread count from 1 doubling up to all cores against the locked
+// baseline, the sharded and the concurrent filter. Arguments: [THREADS] [THETA]
+// [INSERT_PERCENT] [ERASE_PERCENT] [KEYS], where THREADS is the maximum
+// thread count, defaulting to all cores, and THETA 0 means uniform keys.
+int main(int argc, char** argv) {
+  Config config;
+  size_t max_threads = std::thread::hardware_concurrency();
+  if (argc > 1) {
+    max_threads = std::strtoull(argv[1], nullptr, 10);
+  }
+  if (argc > 2) {
+    config.theta = std::strtod(argv[2], nullptr);
+  }
+  if (argc > 3) {
+    config.insert_percent = std::atoi(argv[3]);
+  }
+  if (argc > 4) {
+    config.erase_percent = std::atoi(argv[4]);
+  }
+  if (argc > 5) {
+    config.keys = std::strtoull(argv[5], nullptr, 10);
+  }
+  // the capacity leaves room for inserts beyond the prefilled half
+  size_t capacity = config.keys * 2;
+  ZipfDistribution zipf(config.theta > 0 ? config.keys : 2,
+                        config.theta > 0 ? config.theta : 0.5);
+
+  std::cout << "### " << config.insert_percent << "% inserts, "
+            << config.erase_percent << "% erases, "
+            << (config.theta > 0 ? "zipfian" : "uniform") << " keys ###"
+            << std::endl;
+  std::vector<size_t> thread_counts;
+  for (size_t threads = 1; threads < max_threads; threads *= 2) {
+    thread_counts.push_back(threads);
+  }
+  thread_counts.push_back(max_threads);
+
+  for (size_t threads : thread_counts) {
+    {
+      LockedFilter filter(capacity, config.fingerprint_size);
+      prefill(filter, config);
+      run("locked    ", filter, config, zipf, threads);
+    }
+    {
+      // plenty of shards to keep collisions between threads rare
+      size_t shard_bits = 1;
+      while ((size_t(1) << shard_bits) < 8 * max_threads) {
+        shard_bits++;
+      }
+      ShardedFilter filter(capacity, config.fingerprint_size, shard_bits);
+      prefill(filter, config);
+      run("sharded   ", filter, config, zipf, threads);
+    }
+    {
+      cuculiform::ConcurrentCuckooFilter<uint64_t> filter(
+        capacity, config.fingerprint_size);
+      prefill(filter, config);
+      run("concurrent", filter, config, zipf, threads);
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,53 @@
+#include "cuculiform.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsed_s(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now()
+                                                               - start)
+           .count()
+         / 1e6;
+}
+
+// Serialize and deserialize filters at different loads in the raw and compact
+// formats and report size and throughput relative to the bucket array size.
+int main(int argc, char** argv) {
+  size_t capacity =
+    argc > 1 ? std::strtoull(argv[1], nullptr, 10) : size_t(1) << 26;
+  size_t fingerprint_size = 2;
+  double array_size = static_cast<double>(capacity * fingerprint_size);
+
+  std::cout << "### serialization of a filter with capacity " << capacity
+            << " ###" << std::endl;
+  for (double load : {0.1, 0.5, 0.9}) {
+    cuculiform::CuckooFilter<uint64_t> filter{capacity, fingerprint_size};
+    for (size_t i = 0; i < load * capacity; i++) {
+      filter.insert(i);
+    }
+    cuculiform::CuckooFilter<uint64_t> copy{capacity, fingerprint_size};
+
+    for (bool compact : {false, true}) {
+      std::stringstream stream;
+      auto start = Clock::now();
+      filter.serialize(stream, compact);
+      double encode = elapsed_s(start);
+      double serialized_size = static_cast<double>(stream.str().size());
+
+      start = Clock::now();
+      copy.deserialize(stream);
+      double decode = elapsed_s(start);
+
+      std::cout << "load " << load << (compact ? " compact" : " raw    ")
+                << ": " << serialized_size / array_size * 100
+                << "% of array size, encode " << array_size / encode / 1e9
+                << "GB/s, decode " << array_size / decode / 1e9 << "GB/s"
+                << std::endl;
+    }
+  }
+  return EXIT_SUCCESS;
+}
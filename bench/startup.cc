@@ -0,0 +1,53 @@
+#include "cuculiform.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsed_ms(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now()
+                                                               - start)
+           .count()
+         / 1000.0;
+}
+
+// Time construction, a few inserts and clear() of a filter whose storage comes
+// from the given allocator.
+template <typename Allocator>
+void run(const char* name, size_t capacity, size_t fingerprint_size) {
+  auto start = Clock::now();
+  cuculiform::CuckooFilter<uint64_t, Allocator> filter{capacity,
+                                                       fingerprint_size};
+  double construction = elapsed_ms(start);
+
+  size_t inserts = 100000;
+  start = Clock::now();
+  for (size_t i = 0; i < inserts; i++) {
+    filter.insert(i);
+  }
+  double insertion = elapsed_ms(start);
+
+  start = Clock::now();
+  filter.clear();
+  double reset = elapsed_ms(start);
+
+  std::cout << name << ": construction " << construction << "ms, " << inserts
+            << " inserts " << insertion << "ms, clear " << reset << "ms"
+            << std::endl;
+}
+
+int main(int argc, char** argv) {
+  size_t capacity =
+    argc > 1 ? std::strtoull(argv[1], nullptr, 10) : size_t(1) << 30;
+  size_t fingerprint_size = 2;
+
+  std::cout << "### startup and reset of a filter with capacity " << capacity
+            << " (" << (capacity * fingerprint_size >> 20) << "MiB) ###"
+            << std::endl;
+  run<std::allocator<uint8_t>>("std::allocator", capacity, fingerprint_size);
+  run<cuculiform::LazyZeroAllocator<uint8_t>>("lazy zeroing", capacity,
+                                              fingerprint_size);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cmath>
+#include <random>
+#include <stdint.h>
+
+// Zipfian distribution over the ranks [0, n) with skew theta in [0, 1), as
+// generated by YCSB, see Gray et al., "Quickly Generating Billion-Record
+// Synthetic Databases", SIGMOD 1994. Rank 0 is the most popular.
+class ZipfDistribution {
+public:
+  ZipfDistribution(uint64_t n, double theta)
+      : m_n(n), m_theta(theta), m_zeta_n(zeta(n, theta)) {
+    double zeta_2 = zeta(2, theta);
+    m_alpha = 1 / (1 - theta);
+    m_eta = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta_2 / m_zeta_n);
+  }
+
+  template <typename Generator>
+  uint64_t operator()(Generator& gen) {
+    double u = std::uniform_real_distribution<double>(0, 1)(gen);
+    double uz = u * m_zeta_n;
+    if (uz < 1) {
+      return 0;
+    }
+    if (uz < 1 + std::pow(0.5, m_theta)) {
+      return 1;
+    }
+    uint64_t rank = static_cast<uint64_t>(
+      m_n * std::pow(m_eta * u - m_eta + 1, m_alpha));
+    return rank < m_n ? rank : m_n - 1;
+  }
+
+private:
+  uint64_t m_n;
+  double m_theta;
+  double m_zeta_n;
+  double m_alpha;
+  double m_eta;
+
+  static double zeta(uint64_t n, double theta) {
+    double sum = 0;
+    for (uint64_t i = 1; i <= n; i++) {
+      sum += 1 / std::pow(static_cast<double>(i), theta);
+    }
+    return sum;
+  }
+};
+
+// Spread ranks over the key space, so popular keys don't share buckets
+inline uint64_t scramble(uint64_t rank) {
+  // splitmix64 finalizer, a bijection
+  rank += 0x9E3779B97F4A7C15ull;
+  rank = (rank ^ (rank >> 30)) * 0xBF58476D1CE4E5B9ull;
+  rank = (rank ^ (rank >> 27)) * 0x94D049BB133111EBull;
+  return rank ^ (rank >> 31);
+}
@@ -0,0 +1,334 @@
+#pragma once
+
+#include <assert.h>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "bucket.h"
+#include "util.h"
+
+namespace cuculiform {
+
+// AdaptiveCuckooFilter is a Cuckoo filter that can remove false positives once
+// the caller reports them, as described in "Adaptive Cuckoo Filters" by
+// Mitzenmacher, Pontarelli and Reviriego (ALENEX 2018).
+//
+// Every slot carries a small selector that picks which of several fingerprint
+// hash variants was used to compute the fingerprint stored in it. When a
+// query for a non-member matches a slot, adapt() switches that slot to the
+// next selector and recomputes its fingerprint from the original key, so the
+// same non-member is unlikely to match again.
+//
+// To be able to recompute fingerprints, the original key of every slot is kept
+// in an auxiliary table next to the fingerprints. The table is only touched on
+// insert, erase, relocation and adapt, never by contains, so it may live in
+// slower memory in spirit of the paper's "remote" key store.
+template <typename T>
+class AdaptiveCuckooFilter {
+public:
+  // number of fingerprint hash variants a slot can switch between
+  static constexpr uint8_t selector_count = 4;
+
+  explicit AdaptiveCuckooFilter(
+    size_t capacity, size_t fingerprint_size, uint max_relocations = 500,
+    size_t bucket_size = 4,
+    std::function<uint64_t(size_t)> cuckoo_hash_fn = cuculiform::CityHash{},
+    std::function<uint64_t(size_t)> fingerprint_hash_fn =
+      cuculiform::CityHash{})
+      : m_size(0),
+        m_capacity(capacity),
+        m_bucket_size(bucket_size),
+        m_bucket_count(ceil_to_power_of_two(m_capacity / m_bucket_size)),
+        m_fingerprint_size(fingerprint_size),
+        m_max_relocations(max_relocations),
+        m_cuckoo_hash_fn(cuckoo_hash_fn),
+        m_fingerprint_hash_fn(fingerprint_hash_fn),
+        m_gen(std::random_device{}()),
+        m_index_dis(0, 1),
+        m_bucket_dis(0, m_bucket_size - 1) {
+    assert(m_fingerprint_size > 0);
+    assert(m_fingerprint_size <= 4);
+
+    size_t slot_count = m_bucket_count * m_bucket_size;
+    m_data = std::vector<uint8_t>(slot_count * m_fingerprint_size, 0);
+    m_selectors = std::vector<uint8_t>(slot_count, 0);
+    m_keys = std::vector<T>(slot_count);
+  }
+
+  bool insert(const T item);
+  bool contains(const T item) const;
+  // Report item as a confirmed false positive, i.e. contains(item) returned
+  // true but item has never been inserted. Returns true if at least one slot
+  // has been adapted to no longer match item.
+  bool adapt(const T item);
+  bool erase(const T item);
+  void clear();
+  size_t size() const;
+  size_t capacity() const;
+  size_t memory_usage() const;
+
+private:
+  size_t m_size;
+  std::vector<uint8_t> m_data;      // fingerprints, bucket after bucket
+  std::vector<uint8_t> m_selectors; // fingerprint hash variant of every slot
+  std::vector<T> m_keys;            // original key of every slot
+  const size_t m_capacity;     // total number of fingerprints in the filter
+  const size_t m_bucket_size;  // number of fingerprints that fit in a bucket
+  const size_t m_bucket_count; // number of buckets in the filter
+  const size_t m_fingerprint_size; // size of the fingerprint in bytes
+  const uint m_max_relocations;    // max number of relocations before filled
+  const std::function<uint64_t(size_t)>
+    m_cuckoo_hash_fn; // hash function used for partial cuckoo hashing
+  const std::function<uint64_t(size_t)>
+    m_fingerprint_hash_fn; // hash function used for fingerprinting
+  std::mt19937 m_gen;
+  std::uniform_int_distribution<> m_index_dis;
+  std::uniform_int_distribution<> m_bucket_dis;
+
+  uint64_t get_item_hash(const T& item) const;
+  uint32_t get_fingerprint(const uint64_t item_hash,
+                           const uint8_t selector) const;
+  std::pair<size_t, size_t> get_indexes(const uint64_t item_hash) const;
+
+  Bucket get_bucket(const size_t index);
+  ConstBucket get_bucket(const size_t index) const;
+  bool insert_into_bucket(const size_t index, const T& item,
+                          const uint64_t item_hash);
+};
+
+template <typename T>
+constexpr uint8_t AdaptiveCuckooFilter<T>::selector_count;
+
+template <typename T>
+inline uint64_t AdaptiveCuckooFilter<T>::get_item_hash(const T& item) const {
+  // same normalization as CuckooFilter, see there
+  std::hash<T> weak_hash_fn;
+  return weak_hash_fn(item);
+}
+
+template <typename T>
+inline uint32_t
+AdaptiveCuckooFilter<T>::get_fingerprint(const uint64_t item_hash,
+                                         const uint8_t selector) const {
+  // selector 0 yields the same fingerprint as a plain CuckooFilter, the other
+  // variants salt the item hash with a per-selector odd constant
+  uint64_t salt = selector * 0x9E3779B97F4A7C15ull;
+  uint64_t fingerprint = m_fingerprint_hash_fn(item_hash ^ salt);
+
+  // only use fingerprint_size bytes of the hash
+  fingerprint = fingerprint >> (sizeof(fingerprint) - m_fingerprint_size) * 8;
+  if (fingerprint == 0) {
+    fingerprint = 1;
+  }
+  return static_cast<uint32_t>(fingerprint);
+}
+
+template <typename T>
+inline std::pair<size_t, size_t>
+AdaptiveCuckooFilter<T>::get_indexes(const uint64_t item_hash) const {
+  // Buckets are always derived from the selector 0 fingerprint, so adapting a
+  // slot never changes which buckets its key may live in. As keys are stored,
+  // relocation can recompute both indexes and doesn't need partial hashing.
+  size_t index = m_cuckoo_hash_fn(item_hash) % m_bucket_count;
+  size_t alt_index =
+    index
+    ^ (static_cast<uint32_t>(m_cuckoo_hash_fn(get_fingerprint(item_hash, 0)))
+       % m_bucket_count);
+  return std::make_pair(index, alt_index);
+}
+
+// selectors and keys are indexed by slot number, i.e. bucket index times
+// bucket size plus slot within the bucket
+template <typename T>
+inline Bucket AdaptiveCuckooFilter<T>::get_bucket(const size_t index) {
+  uint8_t* begin = m_data.data() + index * m_bucket_size * m_fingerprint_size;
+  return Bucket(begin, begin + m_bucket_size * m_fingerprint_size,
+                m_fingerprint_size);
+}
+
+template <typename T>
+inline ConstBucket
+AdaptiveCuckooFilter<T>::get_bucket(const size_t index) const {
+  const uint8_t* begin =
+    m_data.data() + index * m_bucket_size * m_fingerprint_size;
+  return ConstBucket(begin, begin + m_bucket_size * m_fingerprint_size,
+                     m_fingerprint_size);
+}
+
+template <typename T>
+inline bool
+AdaptiveCuckooFilter<T>::insert_into_bucket(const size_t index, const T& item,
+                                            const uint64_t item_hash) {
+  size_t slot = 0;
+  if (!get_bucket(index).insert(
+        into_bytes(get_fingerprint(item_hash, 0), m_fingerprint_size),
+        &slot)) {
+    return false;
+  }
+  m_selectors[index * m_bucket_size + slot] = 0;
+  m_keys[index * m_bucket_size + slot] = item;
+  return true;
+}
+
+template <typename T>
+inline bool AdaptiveCuckooFilter<T>::insert(const T item) {
+  uint64_t item_hash = get_item_hash(item);
+  size_t index;
+  size_t alt_index;
+  std::tie(index, alt_index) = get_indexes(item_hash);
+
+  size_t index_to_insert = m_index_dis(m_gen) ? index : alt_index;
+  if (insert_into_bucket(index_to_insert, item, item_hash)
+      || insert_into_bucket(index_to_insert ^ index ^ alt_index, item,
+                            item_hash)) {
+    m_size++;
+    return true;
+  }
+
+  // Relocate whole slots, i.e. fingerprint, selector and key. The victim's
+  // other bucket is recomputed from its key.
+  T key = item;
+  uint64_t key_hash = item_hash;
+  uint32_t fingerprint = get_fingerprint(item_hash, 0);
+  uint8_t selector = 0;
+  for (uint i = 0; i < m_max_relocations; i++) {
+    size_t victim = m_bucket_dis(m_gen);
+    size_t slot = index_to_insert * m_bucket_size + victim;
+    auto bucket = get_bucket(index_to_insert);
+    uint32_t victim_fingerprint = bucket.get(victim);
+    bucket.set(victim, fingerprint);
+    fingerprint = victim_fingerprint;
+    std::swap(m_selectors[slot], selector);
+    std::swap(m_keys[slot], key);
+
+    key_hash = get_item_hash(key);
+    std::tie(index, alt_index) = get_indexes(key_hash);
+    index_to_insert = index_to_insert == index ? alt_index : index;
+
+    size_t free_slot = 0;
+    if (get_bucket(index_to_insert)
+          .insert(into_bytes(fingerprint, m_fingerprint_size), &free_slot)) {
+      slot = index_to_insert * m_bucket_size + free_slot;
+      m_selectors[slot] = selector;
+      m_keys[slot] = key;
+      m_size++;
+      return true;
+    }
+  }
+
+  // like CuckooFilter, the last victim is thrown out
+  return false;
+}
+
+template <typename T>
+inline bool AdaptiveCuckooFilter<T>::contains(const T item) const {
+  uint64_t item_hash = get_item_hash(item);
+  size_t index;
+  size_t alt_index;
+  std::tie(index, alt_index) = get_indexes(item_hash);
+
+  // fingerprints of item under every selector, computed on first use
+  uint32_t fingerprints[selector_count] = {};
+  for (size_t bucket_index : {index, alt_index}) {
+    auto bucket = get_bucket(bucket_index);
+    for (size_t i = 0; i < m_bucket_size; i++) {
+      uint32_t stored = bucket.get(i);
+      if (stored == 0) {
+        continue;
+      }
+      uint8_t selector = m_selectors[bucket_index * m_bucket_size + i];
+      if (fingerprints[selector] == 0) {
+        fingerprints[selector] = get_fingerprint(item_hash, selector);
+      }
+      if (stored == fingerprints[selector]) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+template <typename T>
+inline bool AdaptiveCuckooFilter<T>::adapt(const T item) {
+  uint64_t item_hash = get_item_hash(item);
+  size_t index;
+  size_t alt_index;
+  std::tie(index, alt_index) = get_indexes(item_hash);
+
+  bool adapted = false;
+  for (size_t bucket_index : {index, alt_index}) {
+    auto bucket = get_bucket(bucket_index);
+    for (size_t i = 0; i < m_bucket_size; i++) {
+      size_t slot = bucket_index * m_bucket_size + i;
+      uint32_t stored = bucket.get(i);
+      if (stored == 0
+          || stored != get_fingerprint(item_hash, m_selectors[slot])) {
+        continue;
+      }
+      // a true positive can't be adapted away
+      if (m_keys[slot] == item) {
+        continue;
+      }
+      uint8_t selector = (m_selectors[slot] + 1) % selector_count;
+      m_selectors[slot] = selector;
+      bucket.set(i, get_fingerprint(get_item_hash(m_keys[slot]), selector));
+      adapted = true;
+    }
+    if (index == alt_index) {
+      break;
+    }
+  }
+  return adapted;
+}
+
+template <typename T>
+inline bool AdaptiveCuckooFilter<T>::erase(const T item) {
+  uint64_t item_hash = get_item_hash(item);
+  size_t index;
+  size_t alt_index;
+  std::tie(index, alt_index) = get_indexes(item_hash);
+
+  // with the original keys at hand, erase is exact
+  for (size_t bucket_index : {index, alt_index}) {
+    auto bucket = get_bucket(bucket_index);
+    for (size_t i = 0; i < m_bucket_size; i++) {
+      size_t slot = bucket_index * m_bucket_size + i;
+      if (bucket.get(i) != 0 && m_keys[slot] == item) {
+        bucket.set(i, 0);
+        m_selectors[slot] = 0;
+        m_keys[slot] = T();
+        m_size--;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+template <typename T>
+inline void AdaptiveCuckooFilter<T>::clear() {
+  std::fill(std::begin(m_data), std::end(m_data), 0);
+  std::fill(std::begin(m_selectors), std::end(m_selectors), 0);
+  std::fill(std::begin(m_keys), std::end(m_keys), T());
+  m_size = 0;
+}
+
+template <typename T>
+inline size_t AdaptiveCuckooFilter<T>::size() const {
+  return m_size;
+}
+
+template <typename T>
+inline size_t AdaptiveCuckooFilter<T>::capacity() const {
+  return m_capacity;
+}
+
+template <typename T>
+inline size_t AdaptiveCuckooFilter<T>::memory_usage() const {
+  return sizeof(AdaptiveCuckooFilter<T>) + sizeof(uint8_t) * m_data.size()
+         + sizeof(uint8_t) * m_selectors.size() + sizeof(T) * m_keys.size();
+}
+
+} // namespace cuculiform
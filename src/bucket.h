@@ -11,14 +11,24 @@ using namespace chunked_iterator;
 
 namespace cuculiform {
 
-class Bucket {
+// Buckets work on plain byte pointers, so the filter's storage can come
+// from any allocator or memory region. Byte is uint8_t for Bucket, or const
+// uint8_t for ConstBucket, which only offers the non-modifying operations.
+template <typename Byte>
+class BasicBucket {
 public:
-  using iterator = ChunkedIterator<std::vector<uint8_t>::iterator>;
-  using const_iterator = ChunkedIterator<std::vector<uint8_t>::const_iterator>;
+  using iterator = ChunkedIterator<Byte*>;
+  using const_iterator = ChunkedIterator<const uint8_t*>;
 
-  explicit Bucket(std::vector<uint8_t>::iterator begin,
-                  std::vector<uint8_t>::iterator end, size_t fingerprint_size)
-      : m_begin(begin), m_end(end), m_fingerprint_size(fingerprint_size) {
+  // occupancy is an optional bitmap of the bucket's used slots, kept outside
+  // of the fingerprint bytes. If given, it is kept up to date by all modifying
+  // operations and lets insert find a free slot without a scan.
+  explicit BasicBucket(Byte* begin, Byte* end, size_t fingerprint_size,
+                       Byte* occupancy = nullptr)
+      : m_begin(begin),
+        m_end(end),
+        m_fingerprint_size(fingerprint_size),
+        m_occupancy(occupancy) {
   }
 
   iterator begin();
@@ -28,43 +38,97 @@ public:
   const_iterator cbegin() const;
   const_iterator cend() const;
 
-  bool insert(const std::vector<uint8_t> fingerprint);
+  // if slot is given, it receives the index of the slot that has been used
+  bool insert(const std::vector<uint8_t> fingerprint, size_t* slot = nullptr);
   void swap(std::vector<uint8_t>& fingerprint, size_t index);
   bool contains(const std::vector<uint8_t> fingerprint) const;
   bool erase(const std::vector<uint8_t> fingerprint);
+  // erase fingerprint only if it is stored in the given slot
+  bool erase_at(const std::vector<uint8_t> fingerprint, size_t slot);
+  // the fingerprint in slot as little endian integer, 0 if empty
+  uint32_t get(size_t slot) const;
+  // overwrite slot with fingerprint, 0 empties it
+  void set(size_t slot, uint32_t fingerprint);
   void clear();
+  size_t count() const;
+  bool is_full() const;
 
 private:
   // TODO: misleading name,
   // could be thought this is the same as begin() and end()
-  std::vector<uint8_t>::iterator m_begin;
-  std::vector<uint8_t>::iterator m_end;
+  Byte* m_begin;
+  Byte* m_end;
   const size_t m_fingerprint_size;
+  Byte* m_occupancy;
+
+  size_t slot_count() const;
+  uint8_t full_mask() const;
 };
 
-inline Bucket::iterator Bucket::begin() {
+using Bucket = BasicBucket<uint8_t>;
+using ConstBucket = BasicBucket<const uint8_t>;
+
+template <typename Byte>
+inline typename BasicBucket<Byte>::iterator BasicBucket<Byte>::begin() {
   return iterator(m_begin, m_fingerprint_size, 0);
 }
-inline Bucket::iterator Bucket::end() {
+template <typename Byte>
+inline typename BasicBucket<Byte>::iterator BasicBucket<Byte>::end() {
   return iterator(m_begin, m_fingerprint_size,
                   std::distance(m_begin, m_end) / m_fingerprint_size);
 }
-inline Bucket::const_iterator Bucket::begin() const {
+template <typename Byte>
+inline typename BasicBucket<Byte>::const_iterator
+BasicBucket<Byte>::begin() const {
   return const_iterator(m_begin, m_fingerprint_size, 0);
 }
-inline Bucket::const_iterator Bucket::end() const {
+template <typename Byte>
+inline typename BasicBucket<Byte>::const_iterator
+BasicBucket<Byte>::end() const {
   return const_iterator(m_begin, m_fingerprint_size,
                         std::distance(m_begin, m_end) / m_fingerprint_size);
 }
-inline Bucket::const_iterator Bucket::cbegin() const {
+template <typename Byte>
+inline typename BasicBucket<Byte>::const_iterator
+BasicBucket<Byte>::cbegin() const {
   return const_iterator(m_begin, m_fingerprint_size, 0);
 }
-inline Bucket::const_iterator Bucket::cend() const {
+template <typename Byte>
+inline typename BasicBucket<Byte>::const_iterator
+BasicBucket<Byte>::cend() const {
   return const_iterator(m_begin, m_fingerprint_size,
-                        std::distance(m_begin, m_end));
+                        std::distance(m_begin, m_end) / m_fingerprint_size);
+}
+
+template <typename Byte>
+inline size_t BasicBucket<Byte>::slot_count() const {
+  return std::distance(m_begin, m_end) / m_fingerprint_size;
+}
+
+template <typename Byte>
+inline uint8_t BasicBucket<Byte>::full_mask() const {
+  return static_cast<uint8_t>((1u << slot_count()) - 1);
 }
 
-inline bool Bucket::insert(const std::vector<uint8_t> fingerprint) {
+template <typename Byte>
+inline bool BasicBucket<Byte>::insert(const std::vector<uint8_t> fingerprint,
+                                      size_t* slot) {
+  if (m_occupancy != nullptr) {
+    // with occupancy bits, a full bucket is rejected without touching the
+    // fingerprints and the first free slot is the lowest unset bit
+    uint8_t occupancy = *m_occupancy;
+    if (occupancy == full_mask()) {
+      return false;
+    }
+    size_t index = __builtin_ctz(~static_cast<unsigned>(occupancy));
+    std::copy(fingerprint.begin(), fingerprint.end(), begin()[index].begin);
+    *m_occupancy = occupancy | static_cast<uint8_t>(1u << index);
+    if (slot != nullptr) {
+      *slot = index;
+    }
+    return true;
+  }
+
   // TODO: can empty_fingerprint (and empty_chunk) be allocated once as static
   // member variable so that it is allocated only once? Problem is, we don't
   // know the m_fingerprint_size for a static member variable of Bucket, and
@@ -73,42 +137,120 @@ inline bool Bucket::insert(const std::vector<uint8_t> fingerprint) {
   auto empty_fingerprint = std::vector<uint8_t>(m_fingerprint_size, 0);
   assert(empty_fingerprint != fingerprint);
   auto empty_chunk =
-    iterator::value_type(empty_fingerprint.begin(), empty_fingerprint.end());
+    typename iterator::value_type(empty_fingerprint.data(),
+                                  empty_fingerprint.data()
+                                    + empty_fingerprint.size());
   auto position = std::find(begin(), end(), empty_chunk);
   bool has_empty_position = position != end();
   if (has_empty_position) {
     // found empty position, insert by bytewise-copying the fingerprint into
     // that slot
     std::copy(fingerprint.begin(), fingerprint.end(), position->begin);
+    if (slot != nullptr) {
+      *slot = position - begin();
+    }
   }
   return has_empty_position;
 }
 
-inline void Bucket::swap(std::vector<uint8_t>& fingerprint, size_t index) {
+template <typename Byte>
+inline void BasicBucket<Byte>::swap(std::vector<uint8_t>& fingerprint,
+                                    size_t index) {
   auto chunk = begin()[index];
   // NOTE: could be done with std::swap if Chunk were copy / move constructible
   // from argument
   std::swap_ranges(fingerprint.begin(), fingerprint.end(), chunk.begin);
+  if (m_occupancy != nullptr) {
+    *m_occupancy |= static_cast<uint8_t>(1u << index);
+  }
 }
 
-inline bool Bucket::contains(const std::vector<uint8_t> fingerprint) const {
+template <typename Byte>
+inline bool
+BasicBucket<Byte>::contains(const std::vector<uint8_t> fingerprint) const {
+  if (m_occupancy != nullptr && *m_occupancy == 0) {
+    return false;
+  }
   // NOTE: is value_type semantically correct? Should it be ::reference instead?
   // (doesn't matter though, both is Chunk)
-  auto chunk =
-    const_iterator::value_type(fingerprint.begin(), fingerprint.end());
+  auto chunk = typename const_iterator::value_type(
+    fingerprint.data(), fingerprint.data() + fingerprint.size());
   auto position = std::find(cbegin(), cend(), chunk);
   return position != cend();
 }
 
-inline bool Bucket::erase(std::vector<uint8_t> fingerprint) {
-  auto chunk = iterator::value_type(fingerprint.begin(), fingerprint.end());
+template <typename Byte>
+inline bool BasicBucket<Byte>::erase(std::vector<uint8_t> fingerprint) {
+  auto chunk = typename iterator::value_type(
+    fingerprint.data(), fingerprint.data() + fingerprint.size());
   auto position = std::find(begin(), end(), chunk);
   bool has_fingerprint = position != end();
   if (has_fingerprint) {
     // found that fingerprint, delete it by filling its slot with zeros
     std::fill(position->begin, position->end, 0);
+    if (m_occupancy != nullptr) {
+      *m_occupancy &= static_cast<uint8_t>(~(1u << (position - begin())));
+    }
   }
   return has_fingerprint;
 }
 
+template <typename Byte>
+inline bool
+BasicBucket<Byte>::erase_at(const std::vector<uint8_t> fingerprint,
+                            size_t slot) {
+  auto chunk = begin()[slot];
+  bool has_fingerprint =
+    std::equal(fingerprint.begin(), fingerprint.end(), chunk.begin);
+  if (has_fingerprint) {
+    std::fill(chunk.begin, chunk.end, 0);
+    if (m_occupancy != nullptr) {
+      *m_occupancy &= static_cast<uint8_t>(~(1u << slot));
+    }
+  }
+  return has_fingerprint;
+}
+
+template <typename Byte>
+inline uint32_t BasicBucket<Byte>::get(size_t slot) const {
+  auto chunk = begin()[slot];
+  uint32_t fingerprint = 0;
+  for (size_t i = 0; i < m_fingerprint_size; i++) {
+    fingerprint |= static_cast<uint32_t>(chunk.begin[i]) << i * 8;
+  }
+  return fingerprint;
+}
+
+template <typename Byte>
+inline void BasicBucket<Byte>::set(size_t slot, uint32_t fingerprint) {
+  auto chunk = begin()[slot];
+  for (size_t i = 0; i < m_fingerprint_size; i++) {
+    chunk.begin[i] = static_cast<uint8_t>(fingerprint >> i * 8);
+  }
+  if (m_occupancy != nullptr) {
+    if (fingerprint != 0) {
+      *m_occupancy |= static_cast<uint8_t>(1u << slot);
+    } else {
+      *m_occupancy &= static_cast<uint8_t>(~(1u << slot));
+    }
+  }
+}
+
+template <typename Byte>
+inline size_t BasicBucket<Byte>::count() const {
+  if (m_occupancy != nullptr) {
+    return __builtin_popcount(*m_occupancy);
+  }
+  auto empty_fingerprint = std::vector<uint8_t>(m_fingerprint_size, 0);
+  auto empty_chunk = typename const_iterator::value_type(
+    empty_fingerprint.data(),
+    empty_fingerprint.data() + empty_fingerprint.size());
+  return slot_count() - std::count(cbegin(), cend(), empty_chunk);
+}
+
+template <typename Byte>
+inline bool BasicBucket<Byte>::is_full() const {
+  return count() == slot_count();
+}
+
 } // namespace cuculiform
@@ -0,0 +1,828 @@
+#pragma once
+
+#include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <cerrno>
+#include <fcntl.h>
+#include <functional>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "serialization.h"
+#include "util.h"
+
+namespace cuculiform {
+
+// A mapping of anonymous or POSIX shared memory, unmapped on destruction
+class MappedRegion {
+public:
+  // anonymous memory, shared with children forked afterwards
+  explicit MappedRegion(size_t size) : m_size(size), m_created(true) {
+    map(-1, MAP_SHARED | MAP_ANONYMOUS);
+  }
+  // The shared memory object name, created with size if it doesn't exist,
+  // otherwise attached to. created() tells which one happened.
+  MappedRegion(const std::string& name, size_t size)
+      : m_size(size), m_created(true) {
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+      m_created = false;
+      fd = shm_open(name.c_str(), O_RDWR, 0);
+    }
+    if (fd < 0) {
+      throw std::runtime_error("can't open shared memory " + name);
+    }
+    if (m_created && ftruncate(fd, static_cast<off_t>(size)) != 0) {
+      close(fd);
+      shm_unlink(name.c_str());
+      throw std::runtime_error("can't size shared memory " + name);
+    }
+    // the creator may not have sized it yet
+    struct stat info;
+    while (fstat(fd, &info) == 0 && info.st_size == 0) {
+      std::this_thread::yield();
+    }
+    if (static_cast<size_t>(info.st_size) != size) {
+      close(fd);
+      throw std::runtime_error("shared memory " + name + " has another size");
+    }
+    try {
+      map(fd, MAP_SHARED);
+    } catch (...) {
+      close(fd);
+      throw;
+    }
+    close(fd);
+  }
+  MappedRegion(const MappedRegion&) = delete;
+  MappedRegion& operator=(const MappedRegion&) = delete;
+  ~MappedRegion() {
+    munmap(m_data, m_size);
+  }
+
+  uint8_t* data() const {
+    return m_data;
+  }
+  size_t size() const {
+    return m_size;
+  }
+  bool created() const {
+    return m_created;
+  }
+
+private:
+  uint8_t* m_data;
+  size_t m_size;
+  bool m_created;
+
+  void map(int fd, int flags) {
+    void* data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if (data == MAP_FAILED) {
+      throw std::runtime_error("can't map shared memory");
+    }
+    m_data = static_cast<uint8_t*>(data);
+  }
+};
+
+// A cuckoo filter safe for concurrent lookups, inserts and erases from many
+// threads, or many processes if placed in POSIX shared memory, where a
+// single copy serves all of them.
+//
+// Buckets are guarded by striped seqlocks: lookups never write shared state,
+// they read both buckets and retry if a writer held one of their stripes
+// meanwhile. Inserts lock the stripes of the item's two buckets. Only if both
+// are full, they take a global relocation lock, search a path of kicks to a
+// free slot without modifying anything and then move the fingerprints along
+// it from the end, each move locking its two buckets. So a fingerprint is
+// always in one of its buckets and lookups never miss it. Unlike
+// CuckooFilter, a failed insert leaves the filter unchanged. apply_batch
+// applies a batch to copies of the buckets it touches, including those its
+// kicks pass through, and writes them back holding all their stripes, so
+// lookups see a batch either completely or not at all, and only lookups of
+// these buckets wait for it.
+//
+// All state lives in the mapped region, so every process has to pass the
+// same geometry and hash functions. A process dying while holding a lock
+// blocks the others' writes to that stripe.
+//
+// Layout: a FilterHeader as in serialization.h at offset 0, Control at
+// offset 64, one Stripe per 64 bytes from offset 128, then the bucket array.
+template <typename T>
+class ConcurrentCuckooFilter {
+public:
+  // in memory of this process, shared with children it forks afterwards
+  explicit ConcurrentCuckooFilter(
+    size_t capacity, size_t fingerprint_size, uint max_relocations = 500,
+    size_t bucket_size = 4,
+    std::function<uint64_t(size_t)> cuckoo_hash_fn = cuculiform::CityHash{},
+    std::function<uint64_t(size_t)> fingerprint_hash_fn =
+      cuculiform::CityHash{});
+  // In the POSIX shared memory object name, e.g. "/my-filter", created if it
+  // doesn't exist yet and otherwise attached to. Throws std::runtime_error if
+  // the existing filter has a different size or geometry.
+  ConcurrentCuckooFilter(
+    const std::string& name, size_t capacity, size_t fingerprint_size,
+    uint max_relocations = 500, size_t bucket_size = 4,
+    std::function<uint64_t(size_t)> cuckoo_hash_fn = cuculiform::CityHash{},
+    std::function<uint64_t(size_t)> fingerprint_hash_fn =
+      cuculiform::CityHash{});
+  ConcurrentCuckooFilter(const ConcurrentCuckooFilter&) = delete;
+  ConcurrentCuckooFilter& operator=(const ConcurrentCuckooFilter&) = delete;
+
+  // remove the shared memory object, mappings stay valid until unmapped
+  static void remove(const std::string& name) {
+    shm_unlink(name.c_str());
+  }
+
+  bool insert(const T item);
+  bool contains(const T item) const;
+  bool erase(const T item);
+  // Apply erases, then inserts, all or nothing and visible at once: lookups
+  // see either none or all of the changes. Erasing absent items is a no-op.
+  // Returns false and changes nothing if an insert doesn't fit.
+  bool apply_batch(const std::vector<T>& inserts, const std::vector<T>& erases);
+
+  size_t size() const {
+    return m_control->size.load(std::memory_order_relaxed);
+  }
+  size_t capacity() const {
+    return m_capacity;
+  }
+  double load_factor() const {
+    return static_cast<double>(size()) / (m_bucket_count * m_bucket_size);
+  }
+  size_t memory_usage() const {
+    return m_region.size();
+  }
+  // number of batches applied
+  uint64_t version() const {
+    return m_control->version.load(std::memory_order_acquire);
+  }
+
+private:
+  struct Control {
+    std::atomic<uint32_t> ready; // set once the creator has set up all
+    std::atomic<uint32_t> relocation_lock;
+    std::atomic<uint64_t> size;
+    std::atomic<uint64_t> version;
+  };
+  // seqlock, odd while a writer holds it
+  struct Stripe {
+    std::atomic<uint32_t> sequence;
+  };
+  static constexpr size_t control_offset = 64;
+  static constexpr size_t stripes_offset = 128;
+  static constexpr size_t stripe_stride = 64; // no false sharing of locks
+  static constexpr size_t max_stripes = size_t(1) << 14;
+
+  // a kick: move fingerprint from slot of bucket to its alternate bucket
+  struct Kick {
+    size_t bucket;
+    size_t slot;
+    uint32_t fingerprint;
+  };
+  struct Hashed {
+    size_t index;
+    size_t alt_index;
+    uint32_t fingerprint;
+  };
+  struct Batch {
+    std::vector<Hashed> inserts;
+    std::vector<Hashed> erases;
+    // copies of the buckets the batch touches, its kicks' ones included
+    std::unordered_map<size_t, std::vector<uint32_t>> staged;
+    uint32_t seed; // the same kicks whenever the same buckets are staged
+    size_t erased;
+    size_t missing; // a bucket staging under locks needed, or m_bucket_count
+  };
+  // Holds the relocation lock and, between lock_stripes and unlock_stripes,
+  // the stripes of a batch. Releases them when destroyed, also if the batch
+  // throws, as a stripe left locked would block its readers forever.
+  class BatchLock {
+  public:
+    explicit BatchLock(ConcurrentCuckooFilter& filter)
+        : m_filter(filter), m_stripes(nullptr) {
+      m_filter.lock_relocation();
+    }
+    BatchLock(const BatchLock&) = delete;
+    BatchLock& operator=(const BatchLock&) = delete;
+    ~BatchLock() {
+      unlock_stripes();
+      m_filter.unlock_relocation();
+    }
+    // stripes sorted, so writers can't deadlock, and outliving the lock
+    void lock_stripes(const std::vector<size_t>& stripes) {
+      for (size_t index : stripes) {
+        m_filter.lock_stripe(index);
+      }
+      m_stripes = &stripes;
+    }
+    void unlock_stripes() {
+      if (m_stripes == nullptr) {
+        return;
+      }
+      for (size_t index : *m_stripes) {
+        m_filter.stripe(index).fetch_add(1, std::memory_order_release);
+      }
+      m_stripes = nullptr;
+    }
+
+  private:
+    ConcurrentCuckooFilter& m_filter;
+    const std::vector<size_t>* m_stripes;
+  };
+
+  const size_t m_capacity;
+  const size_t m_bucket_size;
+  const size_t m_bucket_count;
+  const size_t m_fingerprint_size;
+  const size_t m_stripe_count;
+  const uint m_max_relocations;
+  std::function<uint64_t(size_t)> m_cuckoo_hash_fn;
+  std::function<uint64_t(size_t)> m_fingerprint_hash_fn;
+  MappedRegion m_region;
+  Control* m_control;
+  std::atomic<uint8_t>* m_buckets;
+
+  static size_t stripe_count_for(size_t bucket_count) {
+    return std::min(bucket_count, size_t(max_stripes));
+  }
+  static size_t region_size(size_t bucket_count, size_t bucket_size,
+                            size_t fingerprint_size) {
+    return stripes_offset + stripe_count_for(bucket_count) * stripe_stride
+           + bucket_count * bucket_size * fingerprint_size;
+  }
+  FilterHeader get_header() const;
+  void initialize();
+
+  std::atomic<uint32_t>& stripe(size_t bucket) const {
+    return reinterpret_cast<Stripe*>(m_region.data() + stripes_offset
+                                     + (bucket & (m_stripe_count - 1))
+                                         * stripe_stride)
+      ->sequence;
+  }
+  void lock_stripe(size_t stripe) const;
+  void lock(size_t first, size_t second) const;
+  void unlock(size_t first, size_t second) const;
+  void lock_relocation();
+  void unlock_relocation();
+  static std::mt19937& generator() {
+    thread_local std::mt19937 gen(std::random_device{}());
+    return gen;
+  }
+  // snapshot of a stripe's sequence, waiting out writers
+  uint32_t read_begin(size_t bucket) const;
+  bool read_retry(size_t bucket, uint32_t sequence) const;
+
+  uint32_t get_slot(size_t bucket, size_t slot) const;
+  void set_slot(size_t bucket, size_t slot, uint32_t fingerprint);
+  bool bucket_contains(size_t bucket, uint32_t fingerprint) const;
+  // slot index of fingerprint in bucket, or m_bucket_size if absent
+  size_t find_slot(size_t bucket, uint32_t fingerprint) const;
+
+  size_t get_alt_index(size_t index, uint32_t fingerprint) const {
+    return index
+           ^ (static_cast<uint32_t>(m_cuckoo_hash_fn(fingerprint))
+              % m_bucket_count);
+  }
+  void hash(const T& item, size_t& index, size_t& alt_index,
+            uint32_t& fingerprint) const;
+  bool try_insert(size_t index, size_t alt_index, uint32_t fingerprint);
+  bool find_path(size_t start, std::vector<Kick>& path,
+                 std::mt19937& gen) const;
+  bool move_along(const std::vector<Kick>& path);
+  // locked: the caller holds the stripes of all staged buckets
+  void read_bucket(size_t bucket, std::vector<uint32_t>& slots,
+                   bool locked) const;
+  std::vector<uint32_t>* staged_bucket(Batch& batch, size_t bucket,
+                                       bool locked) const;
+  bool stage_batch(Batch& batch, bool locked) const;
+};
+
+template <typename T>
+inline ConcurrentCuckooFilter<T>::ConcurrentCuckooFilter(
+  size_t capacity, size_t fingerprint_size, uint max_relocations,
+  size_t bucket_size, std::function<uint64_t(size_t)> cuckoo_hash_fn,
+  std::function<uint64_t(size_t)> fingerprint_hash_fn)
+    : m_capacity(capacity),
+      m_bucket_size(bucket_size),
+      m_bucket_count(ceil_to_power_of_two(capacity / bucket_size)),
+      m_fingerprint_size(fingerprint_size),
+      m_stripe_count(stripe_count_for(m_bucket_count)),
+      m_max_relocations(max_relocations),
+      m_cuckoo_hash_fn(cuckoo_hash_fn),
+      m_fingerprint_hash_fn(fingerprint_hash_fn),
+      m_region(region_size(m_bucket_count, bucket_size, fingerprint_size)) {
+  assert(m_fingerprint_size > 0);
+  assert(m_fingerprint_size <= 4);
+  initialize();
+}
+
+template <typename T>
+inline ConcurrentCuckooFilter<T>::ConcurrentCuckooFilter(
+  const std::string& name, size_t capacity, size_t fingerprint_size,
+  uint max_relocations, size_t bucket_size,
+  std::function<uint64_t(size_t)> cuckoo_hash_fn,
+  std::function<uint64_t(size_t)> fingerprint_hash_fn)
+    : m_capacity(capacity),
+      m_bucket_size(bucket_size),
+      m_bucket_count(ceil_to_power_of_two(capacity / bucket_size)),
+      m_fingerprint_size(fingerprint_size),
+      m_stripe_count(stripe_count_for(m_bucket_count)),
+      m_max_relocations(max_relocations),
+      m_cuckoo_hash_fn(cuckoo_hash_fn),
+      m_fingerprint_hash_fn(fingerprint_hash_fn),
+      m_region(name,
+               region_size(m_bucket_count, bucket_size, fingerprint_size)) {
+  assert(m_fingerprint_size > 0);
+  assert(m_fingerprint_size <= 4);
+  if (m_region.created()) {
+    initialize();
+    return;
+  }
+  m_control = reinterpret_cast<Control*>(m_region.data() + control_offset);
+  m_buckets = reinterpret_cast<std::atomic<uint8_t>*>(
+    m_region.data() + stripes_offset + m_stripe_count * stripe_stride);
+  while (m_control->ready.load(std::memory_order_acquire) == 0) {
+    std::this_thread::yield();
+  }
+  FilterHeader header = serialization::decode_header(m_region.data());
+  FilterHeader expected = get_header();
+  if (header.fingerprint_size != expected.fingerprint_size
+      || header.bucket_size != expected.bucket_size
+      || header.bucket_count != expected.bucket_count) {
+    throw std::runtime_error("shared filter " + name
+                             + " has a different geometry");
+  }
+}
+
+template <typename T>
+inline FilterHeader ConcurrentCuckooFilter<T>::get_header() const {
+  FilterHeader header;
+  header.magic = FilterHeader::magic_number;
+  header.version = FilterHeader::current_version;
+  header.format = SerializationFormat::Raw;
+  header.fingerprint_size = static_cast<uint8_t>(m_fingerprint_size);
+  header.bucket_size = m_bucket_size;
+  header.bucket_count = m_bucket_count;
+  header.capacity = m_capacity;
+  header.size = 0; // kept in Control while in use
+  header.payload_size = m_bucket_count * m_bucket_size * m_fingerprint_size;
+  return header;
+}
+
+// Construct the atomics in the region, then publish it. Mapped memory is
+// zero-filled, which is the empty state of the bucket array.
+template <typename T>
+inline void ConcurrentCuckooFilter<T>::initialize() {
+  static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2
+                  && ATOMIC_CHAR_LOCK_FREE == 2,
+                "atomics have to be lock-free to work across processes");
+  uint8_t* data = m_region.data();
+  serialization::encode_header(get_header(), data);
+  m_control = new (data + control_offset) Control;
+  m_control->relocation_lock.store(0, std::memory_order_relaxed);
+  m_control->size.store(0, std::memory_order_relaxed);
+  m_control->version.store(0, std::memory_order_relaxed);
+  for (size_t i = 0; i < m_stripe_count; i++) {
+    Stripe* stripe = new (data + stripes_offset + i * stripe_stride) Stripe;
+    stripe->sequence.store(0, std::memory_order_relaxed);
+  }
+  m_buckets = reinterpret_cast<std::atomic<uint8_t>*>(
+    data + stripes_offset + m_stripe_count * stripe_stride);
+  m_control->ready.store(1, std::memory_order_release);
+}
+
+template <typename T>
+inline void ConcurrentCuckooFilter<T>::lock(size_t first,
+                                            size_t second) const {
+  size_t stripes[2] = {first & (m_stripe_count - 1),
+                       second & (m_stripe_count - 1)};
+  // in stripe order, so writers can't deadlock
+  if (stripes[0] > stripes[1]) {
+    std::swap(stripes[0], stripes[1]);
+  }
+  lock_stripe(stripes[0]);
+  if (stripes[0] != stripes[1]) {
+    lock_stripe(stripes[1]);
+  }
+}
+
+template <typename T>
+inline void ConcurrentCuckooFilter<T>::lock_stripe(size_t index) const {
+  std::atomic<uint32_t>& sequence = stripe(index);
+  for (;;) {
+    uint32_t current = sequence.load(std::memory_order_relaxed);
+    if (current % 2 == 0
+        && sequence.compare_exchange_weak(current, current + 1,
+                                          std::memory_order_acquire)) {
+      break;
+    }
+    std::this_thread::yield();
+  }
+  // readers seeing any of the following stores see the odd sequence
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+template <typename T>
+inline void ConcurrentCuckooFilter<T>::lock_relocation() {
+  std::atomic<uint32_t>& relocation_lock = m_control->relocation_lock;
+  uint32_t unlocked = 0;
+  while (!relocation_lock.compare_exchange_weak(unlocked, 1,
+                                                std::memory_order_acquire)) {
+    unlocked = 0;
+    std::this_thread::yield();
+  }
+}
+
+template <typename T>
+inline void ConcurrentCuckooFilter<T>::unlock_relocation() {
+  m_control->relocation_lock.store(0, std::memory_order_release);
+}
+
+template <typename T>
+inline void ConcurrentCuckooFilter<T>::unlock(size_t first,
+                                              size_t second) const {
+  stripe(first).fetch_add(1, std::memory_order_release);
+  if ((first & (m_stripe_count - 1)) != (second & (m_stripe_count - 1))) {
+    stripe(second).fetch_add(1, std::memory_order_release);
+  }
+}
+
+template <typename T>
+inline uint32_t ConcurrentCuckooFilter<T>::read_begin(size_t bucket) const {
+  for (;;) {
+    uint32_t sequence = stripe(bucket).load(std::memory_order_acquire);
+    if (sequence % 2 == 0) {
+      return sequence;
+    }
+    std::this_thread::yield();
+  }
+}
+
+template <typename T>
+inline bool ConcurrentCuckooFilter<T>::read_retry(size_t bucket,
+                                                  uint32_t sequence) const {
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return stripe(bucket).load(std::memory_order_relaxed) != sequence;
+}
+
+template <typename T>
+inline uint32_t ConcurrentCuckooFilter<T>::get_slot(size_t bucket,
+                                                    size_t slot) const {
+  const std::atomic<uint8_t>* bytes =
+    m_buckets + (bucket * m_bucket_size + slot) * m_fingerprint_size;
+  uint32_t fingerprint = 0;
+  for (size_t i = 0; i < m_fingerprint_size; i++) {
+    fingerprint |= static_cast<uint32_t>(
+                     bytes[i].load(std::memory_order_relaxed))
+                   << i * 8;
+  }
+  return fingerprint;
+}
+
+template <typename T>
+inline void ConcurrentCuckooFilter<T>::set_slot(size_t bucket, size_t slot,
+                                                uint32_t fingerprint) {
+  std::atomic<uint8_t>* bytes =
+    m_buckets + (bucket * m_bucket_size + slot) * m_fingerprint_size;
+  for (size_t i = 0; i < m_fingerprint_size; i++) {
+    bytes[i].store(static_cast<uint8_t>(fingerprint >> i * 8),
+                   std::memory_order_relaxed);
+  }
+}
+
+template <typename T>
+inline size_t ConcurrentCuckooFilter<T>::find_slot(size_t bucket,
+                                                   uint32_t fingerprint) const {
+  for (size_t slot = 0; slot < m_bucket_size; slot++) {
+    if (get_slot(bucket, slot) == fingerprint) {
+      return slot;
+    }
+  }
+  return m_bucket_size;
+}
+
+template <typename T>
+inline bool
+ConcurrentCuckooFilter<T>::bucket_contains(size_t bucket,
+                                           uint32_t fingerprint) const {
+  return find_slot(bucket, fingerprint) != m_bucket_size;
+}
+
+// the same hashing as CuckooFilter::get_indexes_and_fingerprint_for
+template <typename T>
+inline void ConcurrentCuckooFilter<T>::hash(const T& item, size_t& index,
+                                            size_t& alt_index,
+                                            uint32_t& fingerprint) const {
+  uint64_t item_hash = std::hash<T>()(item);
+  uint64_t fingerprint_hash = m_fingerprint_hash_fn(item_hash);
+  fingerprint = static_cast<uint32_t>(
+    fingerprint_hash >> (sizeof(fingerprint_hash) - m_fingerprint_size) * 8);
+  if (fingerprint == 0) {
+    fingerprint = 1;
+  }
+  index = m_cuckoo_hash_fn(item_hash) % m_bucket_count;
+  alt_index = get_alt_index(index, fingerprint);
+}
+
+template <typename T>
+inline bool ConcurrentCuckooFilter<T>::contains(const T item) const {
+  size_t index;
+  size_t alt_index;
+  uint32_t fingerprint;
+  hash(item, index, alt_index, fingerprint);
+  for (;;) {
+    uint32_t sequence = read_begin(index);
+    uint32_t alt_sequence = read_begin(alt_index);
+    bool found = bucket_contains(index, fingerprint)
+                 || bucket_contains(alt_index, fingerprint);
+    if (!read_retry(index, sequence) && !read_retry(alt_index, alt_sequence)) {
+      return found;
+    }
+  }
+}
+
+// insert into a free slot of one of the buckets, if there is one
+template <typename T>
+inline bool ConcurrentCuckooFilter<T>::try_insert(size_t index,
+                                                  size_t alt_index,
+                                                  uint32_t fingerprint) {
+  lock(index, alt_index);
+  for (size_t bucket : {index, alt_index}) {
+    size_t slot = find_slot(bucket, 0);
+    if (slot != m_bucket_size) {
+      set_slot(bucket, slot, fingerprint);
+      unlock(index, alt_index);
+      m_control->size.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  unlock(index, alt_index);
+  return false;
+}
+
+template <typename T>
+inline bool ConcurrentCuckooFilter<T>::insert(const T item) {
+  size_t index;
+  size_t alt_index;
+  uint32_t fingerprint;
+  hash(item, index, alt_index, fingerprint);
+  if (try_insert(index, alt_index, fingerprint)) {
+    return true;
+  }
+
+  // one relocating writer at a time, as paths of several could interfere
+  lock_relocation();
+  std::mt19937& gen = generator();
+  std::vector<Kick> path;
+  bool inserted = false;
+  // concurrent inserts and erases may invalidate a path, then search anew
+  for (size_t attempt = 0; attempt < 8 && !inserted; attempt++) {
+    if (!find_path(gen() % 2 ? index : alt_index, path, gen)) {
+      break;
+    }
+    if (move_along(path)) {
+      inserted = try_insert(index, alt_index, fingerprint);
+    }
+  }
+  unlock_relocation();
+  return inserted;
+}
+
+// Random walk from start to a bucket with a free slot, reading only. The
+// path's last kick moves into that bucket, it is empty if start has one.
+template <typename T>
+inline bool ConcurrentCuckooFilter<T>::find_path(size_t start,
+                                                 std::vector<Kick>& path,
+                                                 std::mt19937& gen) const {
+  path.clear();
+  size_t bucket = start;
+  for (uint i = 0; i < m_max_relocations; i++) {
+    uint32_t sequence;
+    size_t free_slot;
+    uint32_t fingerprint;
+    size_t slot = gen() % m_bucket_size;
+    do {
+      sequence = read_begin(bucket);
+      free_slot = find_slot(bucket, 0);
+      fingerprint = get_slot(bucket, slot);
+    } while (read_retry(bucket, sequence));
+    if (free_slot != m_bucket_size) {
+      return true;
+    }
+    path.push_back(Kick{bucket, slot, fingerprint});
+    bucket = get_alt_index(bucket, fingerprint);
+  }
+  return false;
+}
+
+// Execute the kicks from the last one, each copies its fingerprint into the
+// free slot made by the one after it before clearing its own slot. Returns
+// false if the buckets changed since the path was found.
+template <typename T>
+inline bool
+ConcurrentCuckooFilter<T>::move_along(const std::vector<Kick>& path) {
+  for (size_t i = path.size(); i-- > 0;) {
+    const Kick& kick = path[i];
+    size_t target = get_alt_index(kick.bucket, kick.fingerprint);
+    lock(kick.bucket, target);
+    size_t free_slot = find_slot(target, 0);
+    if (free_slot == m_bucket_size
+        || get_slot(kick.bucket, kick.slot) != kick.fingerprint) {
+      unlock(kick.bucket, target);
+      return false;
+    }
+    set_slot(target, free_slot, kick.fingerprint);
+    set_slot(kick.bucket, kick.slot, 0);
+    unlock(kick.bucket, target);
+  }
+  return true;
+}
+
+template <typename T>
+inline bool ConcurrentCuckooFilter<T>::erase(const T item) {
+  size_t index;
+  size_t alt_index;
+  uint32_t fingerprint;
+  hash(item, index, alt_index, fingerprint);
+  lock(index, alt_index);
+  for (size_t bucket : {index, alt_index}) {
+    size_t slot = find_slot(bucket, fingerprint);
+    if (slot != m_bucket_size) {
+      set_slot(bucket, slot, 0);
+      unlock(index, alt_index);
+      m_control->size.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  unlock(index, alt_index);
+  return false;
+}
+
+template <typename T>
+inline bool
+ConcurrentCuckooFilter<T>::apply_batch(const std::vector<T>& inserts,
+                                       const std::vector<T>& erases) {
+  Batch batch;
+  batch.inserts.resize(inserts.size());
+  batch.erases.resize(erases.size());
+  for (size_t i = 0; i < inserts.size(); i++) {
+    Hashed& hashed = batch.inserts[i];
+    hash(inserts[i], hashed.index, hashed.alt_index, hashed.fingerprint);
+  }
+  for (size_t i = 0; i < erases.size(); i++) {
+    Hashed& hashed = batch.erases[i];
+    hash(erases[i], hashed.index, hashed.alt_index, hashed.fingerprint);
+  }
+  for (auto items : {&batch.inserts, &batch.erases}) {
+    for (const Hashed& item : *items) {
+      for (size_t bucket : {item.index, item.alt_index}) {
+        batch.staged.emplace(bucket, std::vector<uint32_t>(m_bucket_size));
+      }
+    }
+  }
+  batch.seed = static_cast<uint32_t>(generator()());
+
+  // declared first, as the lock refers to it until destroyed
+  std::vector<size_t> stripes;
+  // keeps relocating inserts off the buckets while the batch is applied
+  BatchLock lock(*this);
+  for (bool discover = false;; discover = true) {
+    // Once the kicks left the staged buckets, find the ones they go through
+    // without locking anything. Concurrent inserts and erases may still
+    // send them elsewhere, then the next round stages that bucket as well.
+    if (discover) {
+      stage_batch(batch, false);
+    }
+    stripes.clear();
+    for (const auto& bucket : batch.staged) {
+      stripes.push_back(bucket.first & (m_stripe_count - 1));
+    }
+    std::sort(stripes.begin(), stripes.end());
+    stripes.erase(std::unique(stripes.begin(), stripes.end()), stripes.end());
+
+    // nothing is allocated while stripes are locked
+    lock.lock_stripes(stripes);
+    bool fits = stage_batch(batch, true);
+    if (fits) {
+      for (const auto& bucket : batch.staged) {
+        for (size_t slot = 0; slot < m_bucket_size; slot++) {
+          set_slot(bucket.first, slot, bucket.second[slot]);
+        }
+      }
+      m_control->size.fetch_add(batch.inserts.size() - batch.erased,
+                                std::memory_order_relaxed);
+      m_control->version.fetch_add(1, std::memory_order_release);
+    }
+    lock.unlock_stripes();
+    if (fits || batch.missing == m_bucket_count) {
+      return fits;
+    }
+    batch.staged.emplace(batch.missing, std::vector<uint32_t>(m_bucket_size));
+  }
+}
+
+template <typename T>
+inline void
+ConcurrentCuckooFilter<T>::read_bucket(size_t bucket,
+                                       std::vector<uint32_t>& slots,
+                                       bool locked) const {
+  uint32_t sequence;
+  do {
+    sequence = locked ? 0 : read_begin(bucket);
+    for (size_t slot = 0; slot < m_bucket_size; slot++) {
+      slots[slot] = get_slot(bucket, slot);
+    }
+  } while (!locked && read_retry(bucket, sequence));
+}
+
+// The staged copy of bucket. Locked, a bucket not staged yet can't be added
+// without allocating, so it is noted in missing and nullptr returned.
+template <typename T>
+inline std::vector<uint32_t>*
+ConcurrentCuckooFilter<T>::staged_bucket(Batch& batch, size_t bucket,
+                                         bool locked) const {
+  auto position = batch.staged.find(bucket);
+  if (position != batch.staged.end()) {
+    return &position->second;
+  }
+  if (locked) {
+    batch.missing = bucket;
+    return nullptr;
+  }
+  std::vector<uint32_t>& slots = batch.staged[bucket];
+  slots.resize(m_bucket_size);
+  read_bucket(bucket, slots, false);
+  return &slots;
+}
+
+// Apply the batch to fresh copies of the staged buckets, inserts kicking
+// fingerprints as in CuckooFilter. Returns whether all inserts fit. A batch
+// that doesn't fit leaves only its copies changed, so no undo is needed.
+template <typename T>
+inline bool ConcurrentCuckooFilter<T>::stage_batch(Batch& batch,
+                                                   bool locked) const {
+  for (auto& bucket : batch.staged) {
+    read_bucket(bucket.first, bucket.second, locked);
+  }
+  batch.erased = 0;
+  batch.missing = m_bucket_count;
+  // the buckets of the batch's items are always staged
+  for (const Hashed& item : batch.erases) {
+    for (size_t bucket : {item.index, item.alt_index}) {
+      std::vector<uint32_t>& slots = batch.staged.find(bucket)->second;
+      auto slot = std::find(slots.begin(), slots.end(), item.fingerprint);
+      if (slot != slots.end()) {
+        *slot = 0;
+        batch.erased++;
+        break;
+      }
+    }
+  }
+
+  auto put = [](std::vector<uint32_t>& slots, uint32_t fingerprint) {
+    auto slot = std::find(slots.begin(), slots.end(), 0u);
+    if (slot == slots.end()) {
+      return false;
+    }
+    *slot = fingerprint;
+    return true;
+  };
+  std::mt19937 gen(batch.seed);
+  for (const Hashed& item : batch.inserts) {
+    if (put(batch.staged.find(item.index)->second, item.fingerprint)
+        || put(batch.staged.find(item.alt_index)->second, item.fingerprint)) {
+      continue;
+    }
+    uint32_t fingerprint = item.fingerprint;
+    size_t bucket = gen() % 2 ? item.index : item.alt_index;
+    std::vector<uint32_t>* slots = &batch.staged.find(bucket)->second;
+    bool placed = false;
+    for (uint i = 0; i < m_max_relocations && !placed; i++) {
+      std::swap(fingerprint, (*slots)[gen() % m_bucket_size]);
+      bucket = get_alt_index(bucket, fingerprint);
+      slots = staged_bucket(batch, bucket, locked);
+      if (slots == nullptr) {
+        return false;
+      }
+      placed = put(*slots, fingerprint);
+    }
+    if (!placed) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace cuculiform
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <stdint.h>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "bucket.h"
+#include "cycle_detector.h"
+#include "serialization.h"
+#include "util.h"
+
+namespace cuculiform {
+
+// A cuckoo filter in memory owned by the caller, e.g. a mapped file, a block
+// of a larger file, a network message or a shared memory segment. The memory
+// holds a raw serialized filter, i.e. a FilterHeader followed by the bucket
+// array, as written by CuckooFilter::serialize(out, false) or format. Nothing
+// is copied: CuckooFilterView answers lookups straight from the bytes, and
+// MutableCuckooFilterView also inserts and erases in place, keeping the
+// header's size up to date so the memory stays a valid serialized filter.
+//
+// The hash functions have to be the ones the filter was built with. Views
+// track no occupancy bitmaps, so slots are scanned for empty fingerprints.
+// The memory has to outlive the view, and a view is not thread-safe.
+template <typename T, typename Byte>
+class BasicCuckooFilterView {
+public:
+  // Throws std::runtime_error if data doesn't hold a raw serialized filter
+  explicit BasicCuckooFilterView(
+    Byte* data, size_t size,
+    std::function<uint64_t(size_t)> cuckoo_hash_fn = cuculiform::CityHash{},
+    std::function<uint64_t(size_t)> fingerprint_hash_fn =
+      cuculiform::CityHash{},
+    uint max_relocations = 500);
+
+  bool contains(const T item) const;
+  // Only for MutableCuckooFilterView. Like CuckooFilter::insert, a failed
+  // insert throws out some other fingerprint.
+  bool insert(const T item);
+  bool erase(const T item);
+
+  size_t size() const {
+    return m_size;
+  }
+  size_t capacity() const {
+    return m_capacity;
+  }
+  double load_factor() const {
+    return static_cast<double>(m_size) / (m_bucket_count * m_bucket_size);
+  }
+  size_t fingerprint_size() const {
+    return m_fingerprint_size;
+  }
+  size_t bucket_size() const {
+    return m_bucket_size;
+  }
+  size_t bucket_count() const {
+    return m_bucket_count;
+  }
+
+  // bytes an empty filter of this geometry takes, header included
+  static size_t required_size(size_t capacity, size_t fingerprint_size,
+                              size_t bucket_size = 4);
+  // Write an empty filter into [data, data + required_size(...)), the same
+  // as serializing an empty CuckooFilter with these parameters in raw format
+  static void format(uint8_t* data, size_t capacity, size_t fingerprint_size,
+                     size_t bucket_size = 4);
+
+private:
+  using BucketType = BasicBucket<Byte>;
+  using Fingerprint = std::vector<uint8_t>;
+
+  Byte* m_header;
+  Byte* m_buckets;
+  size_t m_size;
+  size_t m_capacity;
+  size_t m_bucket_size;
+  size_t m_bucket_count;
+  size_t m_fingerprint_size;
+  uint m_max_relocations;
+  std::function<uint64_t(size_t)> m_cuckoo_hash_fn;
+  std::function<uint64_t(size_t)> m_fingerprint_hash_fn;
+  std::mt19937 gen;
+
+  size_t get_alt_index(const size_t index,
+                       const Fingerprint& fingerprint) const;
+  std::tuple<size_t, size_t, Fingerprint>
+  get_indexes_and_fingerprint_for(const T item) const;
+  BucketType get_bucket(const size_t index) const;
+  void set_size(size_t size);
+};
+
+template <typename T>
+using CuckooFilterView = BasicCuckooFilterView<T, const uint8_t>;
+template <typename T>
+using MutableCuckooFilterView = BasicCuckooFilterView<T, uint8_t>;
+
+template <typename T, typename Byte>
+inline BasicCuckooFilterView<T, Byte>::BasicCuckooFilterView(
+  Byte* data, size_t size, std::function<uint64_t(size_t)> cuckoo_hash_fn,
+  std::function<uint64_t(size_t)> fingerprint_hash_fn, uint max_relocations)
+    : m_header(data),
+      m_buckets(data + FilterHeader::serialized_size),
+      m_max_relocations(max_relocations),
+      m_cuckoo_hash_fn(cuckoo_hash_fn),
+      m_fingerprint_hash_fn(fingerprint_hash_fn) {
+  if (size < FilterHeader::serialized_size) {
+    throw std::runtime_error("truncated filter header");
+  }
+  FilterHeader header = serialization::decode_header(data);
+  if (header.format != SerializationFormat::Raw) {
+    throw std::runtime_error("only raw serialized filters can be viewed");
+  }
+  if (header.fingerprint_size < 1 || header.fingerprint_size > 4
+      || header.bucket_size == 0 || header.bucket_count == 0
+      || ceil_to_power_of_two(header.bucket_count) != header.bucket_count
+      // the geometry CuckooFilter and format derive from the capacity
+      || ceil_to_power_of_two(header.capacity / header.bucket_size)
+           != header.bucket_count) {
+    throw std::runtime_error("invalid filter geometry");
+  }
+  // crafted headers may make the payload size wrap around to what is there
+  if (header.bucket_size > SIZE_MAX / header.fingerprint_size
+      || header.bucket_count
+           > SIZE_MAX / (header.bucket_size * header.fingerprint_size)) {
+    throw std::runtime_error("invalid filter geometry");
+  }
+  if (header.payload_size
+      != header.bucket_count * header.bucket_size * header.fingerprint_size) {
+    throw std::runtime_error("filter payload size doesn't match geometry");
+  }
+  if (size - FilterHeader::serialized_size < header.payload_size) {
+    throw std::runtime_error("truncated filter payload");
+  }
+  if (header.size > header.bucket_count * header.bucket_size) {
+    throw std::runtime_error("filter size exceeds its slots");
+  }
+  m_size = header.size;
+  m_capacity = header.capacity;
+  m_bucket_size = header.bucket_size;
+  m_bucket_count = header.bucket_count;
+  m_fingerprint_size = header.fingerprint_size;
+
+  if (!std::is_const<Byte>::value) {
+    std::random_device rd;
+    gen.seed(rd());
+  }
+}
+
+template <typename T, typename Byte>
+inline size_t
+BasicCuckooFilterView<T, Byte>::required_size(size_t capacity,
+                                              size_t fingerprint_size,
+                                              size_t bucket_size) {
+  return FilterHeader::serialized_size
+         + ceil_to_power_of_two(capacity / bucket_size) * bucket_size
+             * fingerprint_size;
+}
+
+template <typename T, typename Byte>
+inline void BasicCuckooFilterView<T, Byte>::format(uint8_t* data,
+                                                   size_t capacity,
+                                                   size_t fingerprint_size,
+                                                   size_t bucket_size) {
+  FilterHeader header;
+  header.magic = FilterHeader::magic_number;
+  header.version = FilterHeader::current_version;
+  header.format = SerializationFormat::Raw;
+  header.fingerprint_size = static_cast<uint8_t>(fingerprint_size);
+  header.bucket_size = bucket_size;
+  // the same rounding as CuckooFilter, so the hashes map alike
+  header.bucket_count = ceil_to_power_of_two(capacity / bucket_size);
+  header.capacity = capacity;
+  header.size = 0;
+  header.payload_size =
+    header.bucket_count * header.bucket_size * header.fingerprint_size;
+  serialization::encode_header(header, data);
+  std::fill(data + FilterHeader::serialized_size,
+            data + FilterHeader::serialized_size + header.payload_size, 0);
+}
+
+template <typename T, typename Byte>
+inline size_t
+BasicCuckooFilterView<T, Byte>::get_alt_index(
+  const size_t index, const Fingerprint& fingerprint) const {
+  return index
+         ^ (static_cast<uint32_t>(m_cuckoo_hash_fn(from_bytes(fingerprint)))
+            % m_bucket_count);
+}
+
+// the same hashing as CuckooFilter::get_indexes_and_fingerprint_for
+template <typename T, typename Byte>
+inline std::tuple<size_t, size_t, std::vector<uint8_t>>
+BasicCuckooFilterView<T, Byte>::get_indexes_and_fingerprint_for(
+  const T item) const {
+  uint64_t item_hash = std::hash<T>()(item);
+  uint64_t cuckoo_hash = m_cuckoo_hash_fn(item_hash);
+  uint64_t fingerprint = m_fingerprint_hash_fn(item_hash);
+  fingerprint = fingerprint >> (sizeof(fingerprint) - m_fingerprint_size) * 8;
+  if (fingerprint == 0) {
+    fingerprint = 1;
+  }
+  Fingerprint fingerprint_vec =
+    into_bytes(static_cast<uint32_t>(fingerprint), m_fingerprint_size);
+  size_t index = cuckoo_hash % m_bucket_count;
+  return std::make_tuple(index, get_alt_index(index, fingerprint_vec),
+                         fingerprint_vec);
+}
+
+template <typename T, typename Byte>
+inline typename BasicCuckooFilterView<T, Byte>::BucketType
+BasicCuckooFilterView<T, Byte>::get_bucket(const size_t index) const {
+  Byte* begin = m_buckets + index * m_bucket_size * m_fingerprint_size;
+  return BucketType(begin, begin + m_bucket_size * m_fingerprint_size,
+                    m_fingerprint_size);
+}
+
+template <typename T, typename Byte>
+inline void BasicCuckooFilterView<T, Byte>::set_size(size_t size) {
+  m_size = size;
+  serialization::put_le(m_header + 32, size, 8);
+}
+
+template <typename T, typename Byte>
+inline bool BasicCuckooFilterView<T, Byte>::contains(const T item) const {
+  size_t index;
+  size_t alt_index;
+  Fingerprint fingerprint;
+  std::tie(index, alt_index, fingerprint) =
+    get_indexes_and_fingerprint_for(item);
+  return get_bucket(index).contains(fingerprint)
+         || get_bucket(alt_index).contains(fingerprint);
+}
+
+template <typename T, typename Byte>
+inline bool BasicCuckooFilterView<T, Byte>::insert(const T item) {
+  static_assert(!std::is_const<Byte>::value,
+                "insert needs a MutableCuckooFilterView");
+  size_t index;
+  size_t alt_index;
+  Fingerprint fingerprint;
+  std::tie(index, alt_index, fingerprint) =
+    get_indexes_and_fingerprint_for(item);
+
+  size_t index_to_insert = gen() % 2 ? index : alt_index;
+  if (get_bucket(index_to_insert).insert(fingerprint)) {
+    set_size(m_size + 1);
+    return true;
+  }
+  index_to_insert = get_alt_index(index_to_insert, fingerprint);
+  CycleDetector cycle_detector(2 * m_bucket_size);
+  for (uint i = 0; i < m_max_relocations; i++) {
+    auto bucket = get_bucket(index_to_insert);
+    if (bucket.insert(fingerprint)) {
+      set_size(m_size + 1);
+      return true;
+    }
+    if (cycle_detector.visit(index_to_insert)) {
+      break;
+    }
+    bucket.swap(fingerprint, gen() % m_bucket_size);
+    index_to_insert = get_alt_index(index_to_insert, fingerprint);
+  }
+  return false;
+}
+
+template <typename T, typename Byte>
+inline bool BasicCuckooFilterView<T, Byte>::erase(const T item) {
+  static_assert(!std::is_const<Byte>::value,
+                "erase needs a MutableCuckooFilterView");
+  size_t index;
+  size_t alt_index;
+  Fingerprint fingerprint;
+  std::tie(index, alt_index, fingerprint) =
+    get_indexes_and_fingerprint_for(item);
+  if (get_bucket(index).erase(fingerprint)
+      || get_bucket(alt_index).erase(fingerprint)) {
+    set_size(m_size - 1);
+    return true;
+  }
+  return false;
+}
+
+} // namespace cuculiform
@@ -0,0 +1,424 @@
+#pragma once
+
+#include <algorithm>
+#include <assert.h>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "bucket.h"
+#include "cycle_detector.h"
+#include "statistics.h"
+#include "util.h"
+
+namespace cuculiform {
+
+// CuckooHashMap is the exact companion of CuckooFilter: a hash map with the
+// same bucketed partial-key cuckoo hashing, storing full keys and values.
+//
+// Every slot has a one byte tag, a fingerprint of its key, kept in a tag
+// array of its own with occupancy bitmaps, like a CuckooFilter with one byte
+// fingerprints. Lookups compare keys only where the tag matches, so most
+// misses are resolved without touching the key array. Relocation moves tag,
+// key and value together. As the keys are stored, a victim's other bucket is
+// recomputed from its key, so unlike in the filter, the offset between an
+// item's two buckets isn't limited to the 256 values a tag can select.
+//
+// Unlike the filter, the map must not drop a key when a relocation chain
+// fails, so a failed insert undoes its kicks and leaves the map unchanged.
+// Keys and values have to be default constructible.
+template <typename Key, typename Value>
+class CuckooHashMap {
+public:
+  // number of keys hashed and prefetched ahead of probing by batched find
+  static constexpr size_t batch_size = 16;
+
+  // Throws std::invalid_argument for buckets of more than 8 slots, which
+  // don't fit the occupancy bitmaps.
+  explicit CuckooHashMap(
+    size_t capacity, uint max_relocations = 500, size_t bucket_size = 4,
+    std::function<uint64_t(size_t)> cuckoo_hash_fn = cuculiform::CityHash{},
+    std::function<uint64_t(size_t)> tag_hash_fn = cuculiform::CityHash{})
+      : m_size(0),
+        m_capacity(capacity),
+        m_bucket_size(bucket_size),
+        m_bucket_count(ceil_to_power_of_two(m_capacity / m_bucket_size)),
+        m_max_relocations(max_relocations),
+        m_cuckoo_hash_fn(cuckoo_hash_fn),
+        m_tag_hash_fn(tag_hash_fn),
+        m_gen(std::random_device{}()) {
+    // occupancy bitmaps have one bit per slot
+    if (m_bucket_size > 8) {
+      throw std::invalid_argument("buckets of more than 8 slots");
+    }
+
+    size_t slot_count = m_bucket_count * m_bucket_size;
+    m_tags = std::vector<uint8_t>(slot_count, 0);
+    m_occupancy = std::vector<uint8_t>(m_bucket_count, 0);
+    m_keys = std::vector<Key>(slot_count);
+    m_values = std::vector<Value>(slot_count);
+  }
+
+  // Insert key with value, or assign value if key is present already.
+  // Returns false if the map is too full, leaving it unchanged.
+  bool insert(const Key& key, const Value& value);
+  // pointer to the value of key or nullptr, valid until the next insert
+  const Value* find(const Key& key) const;
+  Value* find(const Key& key);
+  // Look up count keys at once, overlapping their memory accesses. results
+  // receives the value pointers like find would return them. Returns the
+  // number of keys found.
+  size_t find(const Key* keys, size_t count, const Value** results) const;
+  bool contains(const Key& key) const;
+  bool erase(const Key& key);
+  void clear();
+  size_t size() const;
+  size_t capacity() const;
+  double load_factor() const;
+  size_t memory_usage() const;
+  const Statistics& statistics() const;
+
+private:
+  size_t m_size;
+  std::vector<uint8_t> m_tags;      // tag of every slot, 0 if empty
+  std::vector<uint8_t> m_occupancy; // per-bucket bitmap of used slots
+  std::vector<Key> m_keys;          // key of every slot
+  std::vector<Value> m_values;      // value of every slot
+  const size_t m_capacity;     // total number of keys in the map
+  const size_t m_bucket_size;  // number of keys that fit in a bucket
+  const size_t m_bucket_count; // number of buckets in the map
+  const uint m_max_relocations; // max number of relocations before filled
+  const std::function<uint64_t(size_t)>
+    m_cuckoo_hash_fn; // hash function used for partial cuckoo hashing
+  const std::function<uint64_t(size_t)>
+    m_tag_hash_fn; // hash function used for tags
+  std::mt19937 m_gen;
+  Statistics m_statistics;
+
+  struct Hashed {
+    size_t index;
+    size_t alt_index;
+    uint8_t tag;
+  };
+
+  Hashed hash(const Key& key) const;
+  Bucket get_bucket(const size_t index);
+  // store tag in a free slot of bucket index, returns the slot or npos
+  size_t insert_tag(const size_t index, const uint8_t tag);
+  void prefetch(const Hashed& hashed) const;
+  // slot of key in its buckets or npos
+  size_t find_slot(const Key& key, const Hashed& hashed) const;
+  size_t find_in_bucket(const Key& key, const size_t index,
+                        const uint8_t tag) const;
+
+  static constexpr size_t npos = static_cast<size_t>(-1);
+};
+
+template <typename Key, typename Value>
+constexpr size_t CuckooHashMap<Key, Value>::batch_size;
+
+template <typename Key, typename Value>
+constexpr size_t CuckooHashMap<Key, Value>::npos;
+
+template <typename Key, typename Value>
+inline typename CuckooHashMap<Key, Value>::Hashed
+CuckooHashMap<Key, Value>::hash(const Key& key) const {
+  // same normalization as CuckooFilter, see there
+  std::hash<Key> weak_hash_fn;
+  uint64_t key_hash = weak_hash_fn(key);
+  uint8_t tag = static_cast<uint8_t>(m_tag_hash_fn(key_hash) >> 56);
+  if (tag == 0) {
+    tag = 1;
+  }
+  // the offset to the other bucket from the upper half of the same hash
+  uint64_t bucket_hash = m_cuckoo_hash_fn(key_hash);
+  size_t index = bucket_hash % m_bucket_count;
+  return Hashed{index, index ^ ((bucket_hash >> 32) % m_bucket_count), tag};
+}
+
+template <typename Key, typename Value>
+inline Bucket CuckooHashMap<Key, Value>::get_bucket(const size_t index) {
+  uint8_t* begin = m_tags.data() + index * m_bucket_size;
+  return Bucket(begin, begin + m_bucket_size, 1, &m_occupancy[index]);
+}
+
+template <typename Key, typename Value>
+inline size_t CuckooHashMap<Key, Value>::insert_tag(const size_t index,
+                                                    const uint8_t tag) {
+  unsigned free = ~m_occupancy[index] & ((1u << m_bucket_size) - 1);
+  if (free == 0) {
+    return npos;
+  }
+  size_t slot = __builtin_ctz(free);
+  get_bucket(index).set(slot, tag);
+  return index * m_bucket_size + slot;
+}
+
+template <typename Key, typename Value>
+inline void CuckooHashMap<Key, Value>::prefetch(const Hashed& hashed) const {
+  for (size_t index : {hashed.index, hashed.alt_index}) {
+    __builtin_prefetch(&m_tags[index * m_bucket_size]);
+    __builtin_prefetch(&m_occupancy[index]);
+  }
+}
+
+template <typename Key, typename Value>
+inline size_t
+CuckooHashMap<Key, Value>::find_in_bucket(const Key& key, const size_t index,
+                                          const uint8_t tag) const {
+  const uint8_t* tags = &m_tags[index * m_bucket_size];
+  unsigned occupancy = m_occupancy[index];
+  while (occupancy != 0) {
+    size_t slot = __builtin_ctz(occupancy);
+    occupancy &= occupancy - 1;
+    if (tags[slot] == tag && m_keys[index * m_bucket_size + slot] == key) {
+      return index * m_bucket_size + slot;
+    }
+  }
+  return npos;
+}
+
+template <typename Key, typename Value>
+inline size_t
+CuckooHashMap<Key, Value>::find_slot(const Key& key,
+                                     const Hashed& hashed) const {
+  size_t slot = find_in_bucket(key, hashed.index, hashed.tag);
+  if (slot == npos) {
+    slot = find_in_bucket(key, hashed.alt_index, hashed.tag);
+  }
+  return slot;
+}
+
+template <typename Key, typename Value>
+inline bool CuckooHashMap<Key, Value>::insert(const Key& key,
+                                              const Value& value) {
+  Hashed hashed = hash(key);
+  size_t slot = find_slot(key, hashed);
+  if (slot != npos) {
+    m_values[slot] = value;
+    return true;
+  }
+
+  size_t index_to_insert = m_gen() % 2 ? hashed.index : hashed.alt_index;
+  for (size_t index :
+       {index_to_insert, index_to_insert ^ hashed.index ^ hashed.alt_index}) {
+    slot = insert_tag(index, hashed.tag);
+    if (slot != npos) {
+      m_keys[slot] = key;
+      m_values[slot] = value;
+      m_size++;
+      return true;
+    }
+  }
+
+  // kick out like CuckooFilter::insert, remembering the kicked slots
+  index_to_insert = index_to_insert ^ hashed.index ^ hashed.alt_index;
+  uint8_t tag = hashed.tag;
+  Key carried_key = key;
+  Value carried_value = value;
+  std::vector<size_t> kicked;
+  CycleDetector cycle_detector(2 * m_bucket_size);
+  for (uint i = 0; i < m_max_relocations; i++) {
+    if (cycle_detector.visit(index_to_insert)) {
+      m_statistics.cycle_aborts++;
+      break;
+    }
+    size_t victim = m_gen() % m_bucket_size;
+    auto bucket = get_bucket(index_to_insert);
+    uint8_t victim_tag = static_cast<uint8_t>(bucket.get(victim));
+    bucket.set(victim, tag);
+    tag = victim_tag;
+    slot = index_to_insert * m_bucket_size + victim;
+    std::swap(m_keys[slot], carried_key);
+    std::swap(m_values[slot], carried_value);
+    kicked.push_back(slot);
+    m_statistics.relocations++;
+
+    Hashed victim_hashed = hash(carried_key);
+    index_to_insert = index_to_insert == victim_hashed.index
+                        ? victim_hashed.alt_index
+                        : victim_hashed.index;
+    slot = insert_tag(index_to_insert, tag);
+    if (slot != npos) {
+      m_keys[slot] = carried_key;
+      m_values[slot] = carried_value;
+      m_size++;
+      m_statistics.relocated_inserts++;
+      return true;
+    }
+  }
+
+  // undo the kicks in reverse, which puts key back in hand
+  for (auto it = kicked.rbegin(); it != kicked.rend(); ++it) {
+    auto bucket = get_bucket(*it / m_bucket_size);
+    uint8_t victim_tag = static_cast<uint8_t>(bucket.get(*it % m_bucket_size));
+    bucket.set(*it % m_bucket_size, tag);
+    tag = victim_tag;
+    std::swap(m_keys[*it], carried_key);
+    std::swap(m_values[*it], carried_value);
+  }
+  assert(carried_key == key);
+  m_statistics.failed_inserts++;
+  return false;
+}
+
+template <typename Key, typename Value>
+inline const Value* CuckooHashMap<Key, Value>::find(const Key& key) const {
+  size_t slot = find_slot(key, hash(key));
+  return slot == npos ? nullptr : &m_values[slot];
+}
+
+template <typename Key, typename Value>
+inline Value* CuckooHashMap<Key, Value>::find(const Key& key) {
+  size_t slot = find_slot(key, hash(key));
+  return slot == npos ? nullptr : &m_values[slot];
+}
+
+template <typename Key, typename Value>
+inline size_t CuckooHashMap<Key, Value>::find(const Key* keys, size_t count,
+                                              const Value** results) const {
+  size_t found = 0;
+  Hashed hashed[batch_size];
+  for (size_t begin = 0; begin < count; begin += batch_size) {
+    size_t end = std::min(count, begin + batch_size);
+    // hash the whole batch first, so the tag loads of all keys are in flight
+    // before the first one is probed
+    for (size_t i = begin; i < end; i++) {
+      hashed[i - begin] = hash(keys[i]);
+      prefetch(hashed[i - begin]);
+    }
+    for (size_t i = begin; i < end; i++) {
+      size_t slot = find_slot(keys[i], hashed[i - begin]);
+      results[i] = slot == npos ? nullptr : &m_values[slot];
+      found += slot != npos;
+    }
+  }
+  return found;
+}
+
+template <typename Key, typename Value>
+inline bool CuckooHashMap<Key, Value>::contains(const Key& key) const {
+  return find(key) != nullptr;
+}
+
+template <typename Key, typename Value>
+inline bool CuckooHashMap<Key, Value>::erase(const Key& key) {
+  Hashed hashed = hash(key);
+  size_t slot = find_slot(key, hashed);
+  if (slot == npos) {
+    return false;
+  }
+  get_bucket(slot / m_bucket_size).set(slot % m_bucket_size, 0);
+  // release resources held by the key and value
+  m_keys[slot] = Key();
+  m_values[slot] = Value();
+  m_size--;
+  return true;
+}
+
+template <typename Key, typename Value>
+inline void CuckooHashMap<Key, Value>::clear() {
+  std::fill(m_tags.begin(), m_tags.end(), 0);
+  std::fill(m_occupancy.begin(), m_occupancy.end(), 0);
+  std::fill(m_keys.begin(), m_keys.end(), Key());
+  std::fill(m_values.begin(), m_values.end(), Value());
+  m_size = 0;
+}
+
+template <typename Key, typename Value>
+inline size_t CuckooHashMap<Key, Value>::size() const {
+  return m_size;
+}
+
+template <typename Key, typename Value>
+inline size_t CuckooHashMap<Key, Value>::capacity() const {
+  return m_capacity;
+}
+
+template <typename Key, typename Value>
+inline double CuckooHashMap<Key, Value>::load_factor() const {
+  return static_cast<double>(m_size) / m_tags.size();
+}
+
+template <typename Key, typename Value>
+inline size_t CuckooHashMap<Key, Value>::memory_usage() const {
+  return sizeof(CuckooHashMap<Key, Value>) + m_tags.size()
+         + m_occupancy.size() + sizeof(Key) * m_keys.size()
+         + sizeof(Value) * m_values.size();
+}
+
+template <typename Key, typename Value>
+inline const Statistics& CuckooHashMap<Key, Value>::statistics() const {
+  return m_statistics;
+}
+
+// CuckooHashSet stores keys only, on top of CuckooHashMap
+template <typename Key>
+class CuckooHashSet {
+public:
+  explicit CuckooHashSet(
+    size_t capacity, uint max_relocations = 500, size_t bucket_size = 4,
+    std::function<uint64_t(size_t)> cuckoo_hash_fn = cuculiform::CityHash{},
+    std::function<uint64_t(size_t)> tag_hash_fn = cuculiform::CityHash{})
+      : m_map(capacity, max_relocations, bucket_size, cuckoo_hash_fn,
+              tag_hash_fn) {
+  }
+
+  // Returns false if the set is too full, leaving it unchanged
+  bool insert(const Key& key) {
+    return m_map.insert(key, Empty());
+  }
+  bool contains(const Key& key) const {
+    return m_map.contains(key);
+  }
+  // Look up count keys at once, results receives whether each was found.
+  // Returns the number of keys found.
+  size_t contains(const Key* keys, size_t count, bool* results) const;
+  bool erase(const Key& key) {
+    return m_map.erase(key);
+  }
+  void clear() {
+    m_map.clear();
+  }
+  size_t size() const {
+    return m_map.size();
+  }
+  size_t capacity() const {
+    return m_map.capacity();
+  }
+  double load_factor() const {
+    return m_map.load_factor();
+  }
+  size_t memory_usage() const {
+    return m_map.memory_usage();
+  }
+  const Statistics& statistics() const {
+    return m_map.statistics();
+  }
+
+private:
+  struct Empty {};
+
+  CuckooHashMap<Key, Empty> m_map;
+};
+
+template <typename Key>
+inline size_t CuckooHashSet<Key>::contains(const Key* keys, size_t count,
+                                           bool* results) const {
+  const Empty* values[CuckooHashMap<Key, Empty>::batch_size];
+  size_t found = 0;
+  for (size_t begin = 0; begin < count;
+       begin += CuckooHashMap<Key, Empty>::batch_size) {
+    size_t batch =
+      std::min(count - begin, CuckooHashMap<Key, Empty>::batch_size);
+    found += m_map.find(keys + begin, batch, values);
+    for (size_t i = 0; i < batch; i++) {
+      results[begin + i] = values[i] != nullptr;
+    }
+  }
+  return found;
+}
+
+} // namespace cuculiform
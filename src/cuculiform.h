@@ -2,29 +2,59 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <cmath>
+#include <cstring>
 #include <functional>
 #include <iostream>
 #include <iterator>
+#include <memory>
 #include <random>
 #include <tuple>
+#include <utility>
 #include <vector>
 
 #include "bucket.h"
+#include "cycle_detector.h"
 #include "fingerprint.h"
+#include "latency.h"
+#include "memory.h"
+#include "serialization.h"
+#include "statistics.h"
+#include "trace.h"
 #include "util.h"
 
 namespace cuculiform {
 
-template <typename T>
+// Compact reference to the slot an item's fingerprint has been inserted into,
+// see CuckooFilter::insert(item, handle). Relocations may move the fingerprint
+// away from that slot later on, which erase(handle) detects.
+struct SlotHandle {
+  enum : uint8_t { unknown_slot = 0xFF };
+
+  size_t index;         // bucket the fingerprint has been inserted into
+  uint32_t fingerprint; // fingerprint expected in that slot
+  uint8_t slot;         // slot within the bucket or unknown_slot
+};
+
+template <typename T, typename Allocator>
+class WindowedCuckooFilter;
+
+template <typename T, typename Allocator = LazyZeroAllocator<uint8_t>>
 class CuckooFilter {
 public:
+  // track_occupancy keeps a bitmap of used slots per bucket, which lets
+  // inserts and lookups skip full and empty buckets. It is ignored for
+  // buckets of more than 8 slots, which don't fit the bitmap.
   explicit CuckooFilter(
     size_t capacity, size_t fingerprint_size, uint max_relocations = 500,
     size_t bucket_size = 4,
     std::function<uint64_t(size_t)> cuckoo_hash_fn = cuculiform::CityHash{},
     std::function<uint64_t(size_t)> fingerprint_hash_fn =
-      cuculiform::CityHash{})
+      cuculiform::CityHash{},
+    bool track_occupancy = true, const Allocator& allocator = Allocator())
       : m_size(0),
+        m_data(allocator),
+        m_occupancy(allocator),
         m_capacity(capacity),
         m_bucket_size(bucket_size),
         // for partial hashing to work, i.e. not generate invalid bucket
@@ -33,14 +63,18 @@ public:
         m_fingerprint_size(fingerprint_size),
         m_max_relocations(max_relocations),
         m_cuckoo_hash_fn(cuckoo_hash_fn),
-        m_fingerprint_hash_fn(fingerprint_hash_fn),
-        index_dis(0, 1),
-        bucket_dis(0, m_bucket_size - 1) {
+        m_fingerprint_hash_fn(fingerprint_hash_fn) {
     assert(m_fingerprint_size > 0);
     assert(m_fingerprint_size <= 4);
 
-    m_data = std::vector<uint8_t>(m_capacity * fingerprint_size,
-                                  static_cast<uint8_t>(0));
+    // m_bucket_count is rounded up, so there may be more slots than capacity.
+    // Value-initializing resize, which allocators handing out zeroed memory
+    // can turn into a no-op.
+    m_data.resize(m_bucket_count * m_bucket_size * fingerprint_size);
+    // occupancy bitmaps have one bit per slot
+    if (track_occupancy && m_bucket_size <= 8) {
+      m_occupancy.resize(m_bucket_count);
+    }
 
     // Will be used to obtain a seed for the random number engine
     std::random_device rd;
@@ -48,25 +82,153 @@ public:
     /* auto seed = 3377404304; */
     /* std::cerr << "seed: " << seed << std::endl; */
     // Standard mersenne_twister_engine seeded with rd()
-    gen = new std::mt19937(seed);
+    gen.seed(seed);
+  }
+
+  // copy another filter into storage obtained from the given allocator,
+  // e.g. to place a replica on another NUMA node
+  template <typename OtherAllocator>
+  explicit CuckooFilter(const CuckooFilter<T, OtherAllocator>& other,
+                        const Allocator& allocator = Allocator())
+      : m_size(other.m_size),
+        m_data(other.m_data.begin(), other.m_data.end(), allocator),
+        m_occupancy(other.m_occupancy.begin(), other.m_occupancy.end(),
+                    allocator),
+        m_capacity(other.m_capacity),
+        m_bucket_size(other.m_bucket_size),
+        m_bucket_count(other.m_bucket_count),
+        m_fingerprint_size(other.m_fingerprint_size),
+        m_max_relocations(other.m_max_relocations),
+        m_cuckoo_hash_fn(other.m_cuckoo_hash_fn),
+        m_fingerprint_hash_fn(other.m_fingerprint_hash_fn),
+        gen(other.gen),
+        m_statistics(other.m_statistics),
+        m_kicks_per_operation(other.m_kicks_per_operation),
+        m_pending_capacity(other.m_pending_capacity) {
+    for (auto& pending : other.m_pending) {
+      m_pending.push_back(PendingFingerprint{pending.index,
+                                             pending.fingerprint,
+                                             pending.relocations,
+                                             pending.cycle_detector});
+    }
   }
 
   bool insert(const T item);
+  // insert item and obtain a handle for erasing it later on without hashing
+  bool insert(const T item, SlotHandle& handle);
+  // Insert the items of [first, last) in an order that depends only on their
+  // hashes, not on their order in the range. With set_seed and seeded hash
+  // functions, building the same key set into an empty filter always yields
+  // a byte-identical bucket array with the same standard library. Across
+  // libraries, that only holds as far as their std::hash<T> agree, which is
+  // implementation-defined: libstdc++ and libc++ both map integral keys to
+  // themselves, but hash strings differently. Returns the number of items
+  // inserted.
+  template <typename Iterator>
+  size_t insert_bulk(Iterator first, Iterator last);
   bool contains(const T item) const;
   bool erase(const T item);
+  // Erase the item a handle has been obtained for. If its fingerprint has been
+  // relocated meanwhile, this falls back to erasing it by fingerprint from
+  // both of its buckets, exactly like erase(item) would.
+  bool erase(const SlotHandle handle);
   void clear();
+  // Seed the random choices of insertion and relocation, which are otherwise
+  // seeded from std::random_device, to make them reproducible
+  void set_seed(uint64_t seed);
   size_t size() const;
   size_t capacity() const;
+  double load_factor() const;
   size_t memory_usage() const;
   void memory_usage_info() const;
+  const Statistics& statistics() const;
+
+  // Write the filter to out, see serialization.h for the formats. The compact
+  // format drops empty slots and is used if it is smaller than the raw one.
+  // Fingerprints pending in de-amortized mode have to be relocated first.
+  void serialize(std::ostream& out, bool compact = true) const;
+  // Append the serialized filter to out
+  void serialize(std::vector<uint8_t>& out, bool compact = true) const;
+  // Read a filter written by serialize into this filter, decoding straight
+  // into the bucket array. The geometry, i.e. fingerprint size, bucket size
+  // and bucket count, has to match. A delta is applied on top of the current
+  // contents instead. Throws std::runtime_error on malformed input or
+  // mismatching geometry.
+  void deserialize(std::istream& in);
+  // Read a serialized filter from memory, e.g. a mapped file
+  void deserialize(const uint8_t* data, size_t size);
+
+  // Incremental checkpoints: checkpoint writes the whole filter in the raw
+  // format and starts tracking which blocks of dirty_block_bytes of the
+  // bucket array are modified. checkpoint_delta then writes only the blocks
+  // modified since the previous checkpoint or delta, in the delta format, so
+  // its I/O and time scale with the churn rather than the filter size. Both
+  // return the number of bytes written and throw like serialize.
+  static constexpr size_t dirty_block_bytes = 4096;
+  size_t checkpoint(std::ostream& out);
+  size_t checkpoint_delta(std::ostream& out);
+  // Load a checkpoint followed by any number of deltas until the end of in,
+  // e.g. a log they have been appended to. Call it once per file if they are
+  // kept apart. Modifications are tracked afterwards, so further deltas can
+  // be appended to the log.
+  void restore(std::istream& in);
+
+  // The buckets that differ from old, a filter of the same geometry and
+  // hash functions, as a serialized delta. patch applies it to a copy of
+  // old in place, e.g. to keep read replicas in sync with a master filter.
+  // Throws std::runtime_error on mismatching geometry or pending
+  // fingerprints.
+  template <typename OtherAllocator>
+  std::vector<uint8_t> diff(const CuckooFilter<T, OtherAllocator>& old) const;
+  // Throws std::runtime_error if diff isn't a delta of this geometry
+  void patch(const std::vector<uint8_t>& diff);
+
+  // Switch to bounded-latency (de-amortized) insertion: an insert that finds
+  // both buckets full parks the fingerprint in a queue of at most
+  // pending_capacity entries instead of running the relocation chain, and
+  // every following insert and erase spends at most kicks_per_operation kicks
+  // on the queue. Parked fingerprints count towards size() and are seen by
+  // contains and erase. An insert that would overflow the queue returns false
+  // and leaves the filter unchanged. kicks_per_operation = 0 drains the
+  // queue and switches back to regular insertion.
+  // Like the last victim of a failed regular insert, a parked fingerprint
+  // that finds no slot within max_relocations kicks is dropped, although
+  // its insert returned true. It is counted as failed insert in statistics
+  // and its item becomes a false negative.
+  void set_deamortized(size_t kicks_per_operation,
+                       size_t pending_capacity = 16);
+  // Spend at most max_kicks kicks on the pending queue, e.g. from idle time.
+  // Returns the number of fingerprints still pending.
+  size_t relocate_pending(size_t max_kicks);
+  size_t pending() const;
 
-  template <typename U>
+  // Record all following inserts, lookups and erases by item into recorder,
+  // e.g. to replay a production workload with bench/replay.cc. Erases by
+  // handle aren't recorded. nullptr stops recording.
+  // TraceWriter isn't thread-safe and even const lookups write to it, so
+  // while recording, the filter must only be used by one thread at a time,
+  // also if it is otherwise read concurrently, e.g. through VersionedFilter.
+  void set_recorder(TraceWriter* recorder);
+
+  template <typename U, typename A>
+  friend class CuckooFilter;
+  template <typename U, typename A>
+  friend class WindowedCuckooFilter;
+  template <typename U, typename A>
   friend std::ostream& operator<<(std::ostream& out,
-                                  const CuckooFilter<U>& filter);
+                                  const CuckooFilter<U, A>& filter);
+  template <typename U, typename A, typename B>
+  friend double estimate_intersection(const CuckooFilter<U, A>& a,
+                                      const CuckooFilter<U, B>& b);
 
 private:
   size_t m_size;
-  std::vector<uint8_t> m_data;
+  std::vector<uint8_t, Allocator> m_data;
+  // per-bucket bitmap of used slots or empty, from the same allocator as the
+  // bucket array, so arenas and shared segments hold all of the filter
+  using ByteAllocator =
+    typename std::allocator_traits<Allocator>::template rebind_alloc<uint8_t>;
+  std::vector<uint8_t, ByteAllocator> m_occupancy;
   const size_t m_capacity;     // total number of fingerprints in the filter
   const size_t m_bucket_size;  // number of fingerprints that fit in a bucket
   const size_t m_bucket_count; // number of buckets in the filter
@@ -76,9 +238,30 @@ private:
     m_cuckoo_hash_fn; // hash function used for partial cuckoo hashing
   const std::function<uint64_t(size_t)>
     m_fingerprint_hash_fn; // hash function used for fingerprinting
-  std::mt19937 *gen;        // Standard mersenne_twister_engine seeded with rd()
-  std::uniform_int_distribution<> index_dis;
-  std::uniform_int_distribution<> bucket_dis;
+  // Standard mersenne_twister_engine seeded with rd() or set_seed. Its output
+  // is fully specified by the standard, unlike that of the distributions, so
+  // it is used directly to keep the random choices of seeded builds the same
+  // across platforms.
+  std::mt19937 gen;
+  Statistics m_statistics;
+
+  // fingerprint waiting for a slot in de-amortized mode
+  struct PendingFingerprint {
+    size_t index; // bucket to try next
+    Fingerprint fingerprint;
+    uint relocations;
+    CycleDetector cycle_detector;
+  };
+  // a plain vector, as it is short and doesn't allocate until used
+  std::vector<PendingFingerprint> m_pending;
+  size_t m_kicks_per_operation = 0;
+  size_t m_pending_capacity = 0;
+  TraceWriter* m_recorder = nullptr;
+  // a bit per block of the bucket array modified since the last checkpoint,
+  // empty until the first one
+  std::vector<uint64_t> m_dirty;
+
+  void record(const TraceOp op, const T& item) const;
 
   size_t get_alt_index(const size_t index,
                        const uint32_t fingerprint_linear) const;
@@ -86,13 +269,36 @@ private:
   std::tuple<size_t, size_t, Fingerprint>
   get_indexes_and_fingerprint_for(const T item) const;
 
+  // the non-const overload marks the bucket's block dirty
   Bucket get_bucket(const size_t index);
-  const Bucket get_bucket(const size_t index) const;
+  ConstBucket get_bucket(const size_t index) const;
+  size_t dirty_block_buckets() const;
+  void track_dirty();
+  void mark_dirty(size_t first, size_t count);
+  void mark_all_dirty();
+
+  bool insert(const T& item, SlotHandle* handle);
+  // Insert and lookup with the item's hashes computed by the caller. If
+  // given, relocated is set if the insert kicks out other fingerprints.
+  bool insert_fingerprint(const size_t index, const size_t alt_index,
+                          Fingerprint fingerprint, SlotHandle* handle,
+                          bool* relocated = nullptr);
+  bool contains_fingerprint(const size_t index, const size_t alt_index,
+                            const Fingerprint& fingerprint) const;
+  void prefetch_bucket(const size_t index) const;
+
+  FilterHeader get_header() const;
+  FilterHeader serialization_header(bool compact) const;
+  void check_header(const FilterHeader& header) const;
+  void read_payload(std::istream& in, const FilterHeader& header);
+  void load_payload(const FilterHeader& header, const uint8_t* payload);
+  bool erase_fingerprint(const size_t index, const size_t alt_index,
+                         const Fingerprint& fingerprint);
 };
 
-template <typename T>
+template <typename T, typename Allocator>
 inline size_t
-CuckooFilter<T>::get_alt_index(const size_t index,
+CuckooFilter<T, Allocator>::get_alt_index(const size_t index,
                                const uint32_t fingerprint_linear) const {
   size_t alt_index =
     index
@@ -102,17 +308,18 @@ CuckooFilter<T>::get_alt_index(const size_t index,
   return alt_index;
 }
 
-template <typename T>
+template <typename T, typename Allocator>
 inline size_t
-CuckooFilter<T>::get_alt_index(const size_t index,
+CuckooFilter<T, Allocator>::get_alt_index(const size_t index,
                                const Fingerprint fingerprint) const {
   uint32_t fingerprint_linear = from_bytes(fingerprint);
   return get_alt_index(index, fingerprint_linear);
 }
 
-template <typename T>
+template <typename T, typename Allocator>
 inline std::tuple<size_t, size_t, Fingerprint>
-CuckooFilter<T>::get_indexes_and_fingerprint_for(const T item) const {
+CuckooFilter<T, Allocator>::get_indexes_and_fingerprint_for(
+  const T item) const {
   // use std::hash to normalize any type to a size_t.
   // Note that it doesn't necessarily produce distributed hashes,
   // i.e. for uints, it might just be the identity function.
@@ -149,55 +356,136 @@ CuckooFilter<T>::get_indexes_and_fingerprint_for(const T item) const {
   return std::make_tuple(index, alt_index, fingerprint_vec);
 }
 
-template <typename T>
-Bucket CuckooFilter<T>::get_bucket(const size_t index) {
-  return Bucket(
-    std::next(m_data.begin(), index * m_bucket_size * m_fingerprint_size),
-    std::next(m_data.begin(), (index + 1) * m_bucket_size * m_fingerprint_size),
-    m_fingerprint_size);
+template <typename T, typename Allocator>
+Bucket CuckooFilter<T, Allocator>::get_bucket(const size_t index) {
+  mark_dirty(index, 1);
+  uint8_t* begin = m_data.data() + index * m_bucket_size * m_fingerprint_size;
+  return Bucket(begin, begin + m_bucket_size * m_fingerprint_size,
+                m_fingerprint_size,
+                m_occupancy.empty() ? nullptr : &m_occupancy[index]);
 }
 
-template <typename T>
-const Bucket CuckooFilter<T>::get_bucket(const size_t index) const {
-  // yes this is cheating around not being able to create a Bucket with const
-  // iterators, but should work because we return a const bucket
-  auto& data_noconst = const_cast<std::vector<uint8_t>&>(m_data);
-  return Bucket(
-    std::next(data_noconst.begin(), index * m_bucket_size * m_fingerprint_size),
-    std::next(data_noconst.begin(),
-              (index + 1) * m_bucket_size * m_fingerprint_size),
-    m_fingerprint_size);
+template <typename T, typename Allocator>
+ConstBucket CuckooFilter<T, Allocator>::get_bucket(const size_t index) const {
+  const uint8_t* begin =
+    m_data.data() + index * m_bucket_size * m_fingerprint_size;
+  return ConstBucket(begin, begin + m_bucket_size * m_fingerprint_size,
+                     m_fingerprint_size,
+                     m_occupancy.empty() ? nullptr : &m_occupancy[index]);
 }
 
-template <typename T>
-inline bool CuckooFilter<T>::insert(const T item) {
+template <typename T, typename Allocator>
+inline bool CuckooFilter<T, Allocator>::insert(const T item) {
+  return insert(item, nullptr);
+}
+
+template <typename T, typename Allocator>
+inline bool CuckooFilter<T, Allocator>::insert(const T item,
+                                               SlotHandle& handle) {
+  return insert(item, &handle);
+}
+
+template <typename T, typename Allocator>
+inline bool CuckooFilter<T, Allocator>::insert(const T& item,
+                                               SlotHandle* handle) {
   size_t index;
   size_t alt_index;
   Fingerprint fingerprint;
+  // insert_fingerprint tells whether the insert needed relocations
+  bool relocated = false;
+  CUCULIFORM_LATENCY_SCOPE(latency::Operation::InsertDirect, &relocated);
 
+  record(TraceOp::Insert, item);
   std::tie(index, alt_index, fingerprint) =
     get_indexes_and_fingerprint_for(item);
+  return insert_fingerprint(index, alt_index, std::move(fingerprint), handle,
+                            &relocated);
+}
+
+template <typename T, typename Allocator>
+inline bool CuckooFilter<T, Allocator>::insert_fingerprint(
+  const size_t index, const size_t alt_index, Fingerprint fingerprint,
+  SlotHandle* handle, bool* relocated) {
   assert(index == get_alt_index(alt_index, fingerprint));
 
   // TODO: insert two times the same value?
 
-  size_t index_to_insert = index_dis(*gen) ? index : alt_index;
-  bool inserted = get_bucket(index_to_insert).insert(fingerprint);
+  if (!m_pending.empty()) {
+    relocate_pending(m_kicks_per_operation);
+  }
+
+  // the slot the item's own fingerprint ends up in, reported via handle
+  size_t slot = SlotHandle::unknown_slot;
+  size_t index_to_insert = gen() % 2 ? index : alt_index;
+  if (handle != nullptr) {
+    *handle = SlotHandle{index_to_insert, from_bytes(fingerprint),
+                         SlotHandle::unknown_slot};
+  }
+  bool inserted = get_bucket(index_to_insert).insert(fingerprint, &slot);
   if (inserted) {
+    if (handle != nullptr) {
+      handle->slot = static_cast<uint8_t>(slot);
+    }
+    m_size++;
+    return true;
+  }
+
+  if (m_kicks_per_operation > 0) {
+    index_to_insert = get_alt_index(index_to_insert, fingerprint);
+    if (handle != nullptr) {
+      handle->index = index_to_insert;
+    }
+    if (get_bucket(index_to_insert).insert(fingerprint, &slot)) {
+      if (handle != nullptr) {
+        handle->slot = static_cast<uint8_t>(slot);
+      }
+      m_size++;
+      return true;
+    }
+    if (m_pending.size() >= m_pending_capacity) {
+      m_statistics.failed_inserts++;
+      return false;
+    }
+    m_pending.push_back(PendingFingerprint{
+      index_to_insert, fingerprint, 0, CycleDetector(2 * m_bucket_size)});
     m_size++;
     return true;
   }
 
   index_to_insert = get_alt_index(index_to_insert, fingerprint);
+  if (handle != nullptr) {
+    handle->index = index_to_insert;
+  }
+  // near saturation, the chain may bounce among a few full buckets until
+  // m_max_relocations is exhausted, so give up as soon as that is evident
+  CycleDetector cycle_detector(2 * m_bucket_size);
   for (uint i = 0; i < m_max_relocations; i++) {
     auto bucket = get_bucket(index_to_insert);
-    bool inserted = bucket.insert(fingerprint);
+    bool inserted = bucket.insert(fingerprint, &slot);
     if (inserted) {
+      if (handle != nullptr && i == 0) {
+        handle->slot = static_cast<uint8_t>(slot);
+      }
       m_size++;
+      if (i > 0) {
+        m_statistics.relocated_inserts++;
+      }
       return true;
     } else {
-      size_t fingerprint_to_relocate = bucket_dis(*gen);
+      if (cycle_detector.visit(index_to_insert)) {
+        m_statistics.cycle_aborts++;
+        break;
+      }
+      size_t fingerprint_to_relocate = gen() % m_bucket_size;
       bucket.swap(fingerprint, fingerprint_to_relocate);
+      m_statistics.relocations++;
+      // unlike the kicks of relocate_pending above, which are other items'
+      if (relocated != nullptr) {
+        *relocated = true;
+      }
+      if (handle != nullptr && i == 0) {
+        handle->slot = static_cast<uint8_t>(fingerprint_to_relocate);
+      }
 
       index_to_insert = get_alt_index(index_to_insert, fingerprint);
     }
@@ -205,78 +493,615 @@ inline bool CuckooFilter<T>::insert(const T item) {
 
   // TODO: have a victim cache like the reference implementation instead of
   // throwing the last element out?
+  m_statistics.failed_inserts++;
   return false;
 }
 
-template <typename T>
-inline bool CuckooFilter<T>::contains(const T item) const {
+template <typename T, typename Allocator>
+template <typename Iterator>
+inline size_t CuckooFilter<T, Allocator>::insert_bulk(Iterator first,
+                                                      Iterator last) {
+  // sort by bucket and fingerprint, items equal in both are interchangeable
+  std::vector<std::pair<size_t, uint32_t>> hashed;
+  for (; first != last; ++first) {
+    size_t index;
+    size_t alt_index;
+    Fingerprint fingerprint;
+    record(TraceOp::Insert, *first);
+    std::tie(index, alt_index, fingerprint) =
+      get_indexes_and_fingerprint_for(*first);
+    hashed.emplace_back(index, from_bytes(fingerprint));
+  }
+  std::sort(hashed.begin(), hashed.end());
+
+  size_t inserted = 0;
+  for (auto& item : hashed) {
+    inserted += insert_fingerprint(
+      item.first, get_alt_index(item.first, item.second),
+      into_bytes(item.second, m_fingerprint_size), nullptr);
+  }
+  return inserted;
+}
+
+template <typename T, typename Allocator>
+inline bool CuckooFilter<T, Allocator>::contains(const T item) const {
   size_t index;
   size_t alt_index;
   std::vector<uint8_t> fingerprint;
+  CUCULIFORM_LATENCY_SCOPE(latency::Operation::Contains);
+  record(TraceOp::Contains, item);
   std::tie(index, alt_index, fingerprint) =
     get_indexes_and_fingerprint_for(item);
+  return contains_fingerprint(index, alt_index, fingerprint);
+}
 
+template <typename T, typename Allocator>
+inline bool CuckooFilter<T, Allocator>::contains_fingerprint(
+  const size_t index, const size_t alt_index,
+  const Fingerprint& fingerprint) const {
   assert(alt_index == get_alt_index(index, fingerprint));
   assert(index == get_alt_index(alt_index, fingerprint));
 
   bool contained = get_bucket(index).contains(fingerprint)
                    || get_bucket(alt_index).contains(fingerprint);
+  if (!contained && !m_pending.empty()) {
+    // a pending fingerprint belongs to item if it waits for one of item's
+    // buckets, as the other one is then item's other bucket as well
+    for (auto& pending : m_pending) {
+      if (pending.fingerprint == fingerprint
+          && (pending.index == index || pending.index == alt_index)) {
+        return true;
+      }
+    }
+  }
   return contained;
 }
 
-template <typename T>
-inline bool CuckooFilter<T>::erase(const T item) {
+template <typename T, typename Allocator>
+inline void
+CuckooFilter<T, Allocator>::prefetch_bucket(const size_t index) const {
+  const uint8_t* begin =
+    m_data.data() + index * m_bucket_size * m_fingerprint_size;
+  __builtin_prefetch(begin);
+  if (!m_occupancy.empty()) {
+    __builtin_prefetch(&m_occupancy[index]);
+  }
+}
+
+template <typename T, typename Allocator>
+inline bool CuckooFilter<T, Allocator>::erase(const T item) {
   size_t index;
   size_t alt_index;
   std::vector<uint8_t> fingerprint;
+  CUCULIFORM_LATENCY_SCOPE(latency::Operation::Erase);
+  record(TraceOp::Erase, item);
   std::tie(index, alt_index, fingerprint) =
     get_indexes_and_fingerprint_for(item);
 
   // TODO: Same element removed two times?
+  return erase_fingerprint(index, alt_index, fingerprint);
+}
+
+template <typename T, typename Allocator>
+inline bool CuckooFilter<T, Allocator>::erase(const SlotHandle handle) {
+  Fingerprint fingerprint = into_bytes(handle.fingerprint, m_fingerprint_size);
+  if (handle.slot != SlotHandle::unknown_slot
+      && get_bucket(handle.index).erase_at(fingerprint, handle.slot)) {
+    m_size--;
+    if (!m_pending.empty()) {
+      relocate_pending(m_kicks_per_operation);
+    }
+    return true;
+  }
+  return erase_fingerprint(handle.index,
+                           get_alt_index(handle.index, handle.fingerprint),
+                           fingerprint);
+}
+
+template <typename T, typename Allocator>
+inline bool
+CuckooFilter<T, Allocator>::erase_fingerprint(const size_t index,
+                                              const size_t alt_index,
+                                              const Fingerprint& fingerprint) {
   bool erased = get_bucket(index).erase(fingerprint)
                 || get_bucket(alt_index).erase(fingerprint);
+  if (!erased) {
+    for (auto it = m_pending.begin(); it != m_pending.end(); ++it) {
+      if (it->fingerprint == fingerprint
+          && (it->index == index || it->index == alt_index)) {
+        m_pending.erase(it);
+        erased = true;
+        break;
+      }
+    }
+  }
   if (erased) {
     m_size--;
   }
+  if (!m_pending.empty()) {
+    relocate_pending(m_kicks_per_operation);
+  }
   return erased;
 }
 
-template <typename T>
-inline void CuckooFilter<T>::clear() {
-  std::fill(std::begin(m_data), std::end(m_data), 0);
+template <typename T, typename Allocator>
+inline void
+CuckooFilter<T, Allocator>::set_deamortized(size_t kicks_per_operation,
+                                            size_t pending_capacity) {
+  m_kicks_per_operation = kicks_per_operation;
+  m_pending_capacity = pending_capacity;
+  // an entry takes up to m_max_relocations + 1 kicks to be placed or dropped
+  while (m_kicks_per_operation == 0 && !m_pending.empty()) {
+    relocate_pending(m_max_relocations + 1);
+  }
+}
+
+template <typename T, typename Allocator>
+inline size_t CuckooFilter<T, Allocator>::relocate_pending(size_t max_kicks) {
+  for (size_t kick = 0; kick < max_kicks && !m_pending.empty(); kick++) {
+    auto& pending = m_pending.front();
+    auto bucket = get_bucket(pending.index);
+    if (bucket.insert(pending.fingerprint)) {
+      m_statistics.relocated_inserts++;
+      m_pending.erase(m_pending.begin());
+      continue;
+    }
+    // same give-up conditions as a regular relocation chain
+    bool trapped = pending.cycle_detector.visit(pending.index);
+    if (trapped || pending.relocations >= m_max_relocations) {
+      if (trapped) {
+        m_statistics.cycle_aborts++;
+      }
+      m_statistics.failed_inserts++;
+      m_pending.erase(m_pending.begin());
+      m_size--;
+      continue;
+    }
+    bucket.swap(pending.fingerprint, gen() % m_bucket_size);
+    m_statistics.relocations++;
+    pending.relocations++;
+    pending.index = get_alt_index(pending.index, pending.fingerprint);
+  }
+  return m_pending.size();
+}
+
+template <typename T, typename Allocator>
+inline size_t CuckooFilter<T, Allocator>::pending() const {
+  return m_pending.size();
+}
+
+template <typename T, typename Allocator>
+inline void CuckooFilter<T, Allocator>::set_recorder(TraceWriter* recorder) {
+  m_recorder = recorder;
+}
+
+template <typename T, typename Allocator>
+inline void CuckooFilter<T, Allocator>::record(const TraceOp op,
+                                               const T& item) const {
+  if (m_recorder != nullptr) {
+    m_recorder->record(op, std::hash<T>{}(item));
+  }
+}
+
+template <typename T, typename Allocator>
+inline void CuckooFilter<T, Allocator>::clear() {
+  zero_memory(m_data.get_allocator(), m_data.data(), m_data.size());
+  zero_memory(m_occupancy.get_allocator(), m_occupancy.data(),
+              m_occupancy.size());
+  m_pending.clear();
   m_size = 0;
+  mark_all_dirty();
+}
+
+template <typename T, typename Allocator>
+inline void CuckooFilter<T, Allocator>::set_seed(uint64_t seed) {
+  std::seed_seq sequence{static_cast<uint32_t>(seed),
+                         static_cast<uint32_t>(seed >> 32)};
+  gen.seed(sequence);
 }
 
-template <typename T>
-inline size_t CuckooFilter<T>::size() const {
+template <typename T, typename Allocator>
+inline size_t CuckooFilter<T, Allocator>::size() const {
   return m_size;
 }
 
-template <typename T>
-inline size_t CuckooFilter<T>::capacity() const {
+template <typename T, typename Allocator>
+inline size_t CuckooFilter<T, Allocator>::capacity() const {
   return m_capacity;
 }
 
-template <typename T>
-inline size_t CuckooFilter<T>::memory_usage() const {
-  return sizeof(CuckooFilter<T>) + sizeof(uint8_t) * m_data.size();
+template <typename T, typename Allocator>
+inline double CuckooFilter<T, Allocator>::load_factor() const {
+  return static_cast<double>(m_size)
+         / static_cast<double>(m_bucket_count * m_bucket_size);
+}
+
+template <typename T, typename Allocator>
+inline size_t CuckooFilter<T, Allocator>::memory_usage() const {
+  return sizeof(CuckooFilter<T, Allocator>) + sizeof(uint8_t) * m_data.size()
+         + sizeof(uint8_t) * m_occupancy.size();
+}
+
+template <typename T, typename Allocator>
+inline const Statistics& CuckooFilter<T, Allocator>::statistics() const {
+  return m_statistics;
+}
+
+template <typename T, typename Allocator>
+inline FilterHeader CuckooFilter<T, Allocator>::get_header() const {
+  FilterHeader header;
+  header.magic = FilterHeader::magic_number;
+  header.version = FilterHeader::current_version;
+  header.format = SerializationFormat::Raw;
+  header.fingerprint_size = static_cast<uint8_t>(m_fingerprint_size);
+  header.bucket_size = m_bucket_size;
+  header.bucket_count = m_bucket_count;
+  header.capacity = m_capacity;
+  header.size = m_size;
+  header.payload_size = m_data.size();
+  return header;
+}
+
+template <typename T, typename Allocator>
+inline void
+CuckooFilter<T, Allocator>::check_header(const FilterHeader& header) const {
+  if (header.fingerprint_size != m_fingerprint_size
+      || header.bucket_size != m_bucket_size
+      || header.bucket_count != m_bucket_count) {
+    throw std::runtime_error("filter geometry mismatch");
+  }
+  if (header.format == SerializationFormat::Raw
+      && header.payload_size != m_data.size()) {
+    throw std::runtime_error("malformed filter payload");
+  }
+  if (header.size > m_bucket_count * m_bucket_size) {
+    throw std::runtime_error("filter size exceeds its slots");
+  }
+}
+
+// The header to serialize with, compact only if that is smaller than raw,
+// which takes a pass over the buckets to count the compact encoding's size
+template <typename T, typename Allocator>
+inline FilterHeader
+CuckooFilter<T, Allocator>::serialization_header(bool compact) const {
+  if (!m_pending.empty()) {
+    throw std::runtime_error("can't serialize pending fingerprints");
+  }
+  FilterHeader header = get_header();
+  // the compact format has no room for more than 8 fingerprints per bucket
+  if (compact && m_bucket_size <= 8) {
+    serialization::CountingOutput counter;
+    serialization::encode_compact(m_data.data(), m_bucket_count,
+                                  m_bucket_size, m_fingerprint_size, counter);
+    if (counter.size < m_data.size()) {
+      header.format = SerializationFormat::Compact;
+      header.payload_size = counter.size;
+    }
+  }
+  return header;
+}
+
+// the compact encoding is streamed, it's never held in memory as a whole
+template <typename T, typename Allocator>
+inline void CuckooFilter<T, Allocator>::serialize(std::ostream& out,
+                                                  bool compact) const {
+  FilterHeader header = serialization_header(compact);
+  serialization::write_header(out, header);
+  if (header.format == SerializationFormat::Raw) {
+    out.write(reinterpret_cast<const char*>(m_data.data()), m_data.size());
+    return;
+  }
+  serialization::StreamOutput output(out);
+  serialization::encode_compact(m_data.data(), m_bucket_count, m_bucket_size,
+                                m_fingerprint_size, output);
+  output.flush();
+}
+
+template <typename T, typename Allocator>
+inline void CuckooFilter<T, Allocator>::serialize(std::vector<uint8_t>& out,
+                                                  bool compact) const {
+  FilterHeader header = serialization_header(compact);
+  size_t offset = out.size();
+  size_t payload_offset = offset + FilterHeader::serialized_size;
+  out.resize(payload_offset + header.payload_size);
+  serialization::encode_header(header, out.data() + offset);
+  if (header.format == SerializationFormat::Raw) {
+    std::copy(m_data.begin(), m_data.end(), out.begin() + payload_offset);
+    return;
+  }
+  serialization::MemoryOutput output{out.data() + payload_offset};
+  serialization::encode_compact(m_data.data(), m_bucket_count, m_bucket_size,
+                                m_fingerprint_size, output);
+}
+
+template <typename T, typename Allocator>
+inline void CuckooFilter<T, Allocator>::deserialize(std::istream& in) {
+  read_payload(in, serialization::read_header(in));
+}
+
+// load the payload that follows header in in
+template <typename T, typename Allocator>
+inline void
+CuckooFilter<T, Allocator>::read_payload(std::istream& in,
+                                         const FilterHeader& header) {
+  check_header(header);
+
+  if (header.format != SerializationFormat::Raw) {
+    std::vector<uint8_t> payload(header.payload_size);
+    in.read(reinterpret_cast<char*>(payload.data()), payload.size());
+    if (!in) {
+      throw std::runtime_error("truncated filter payload");
+    }
+    load_payload(header, payload.data());
+    return;
+  }
+
+  // read raw payloads straight into the bucket array
+  in.read(reinterpret_cast<char*>(m_data.data()), m_data.size());
+  if (!in) {
+    clear();
+    throw std::runtime_error("truncated filter payload");
+  }
+  load_payload(header, m_data.data());
+}
+
+template <typename T, typename Allocator>
+inline void CuckooFilter<T, Allocator>::deserialize(const uint8_t* data,
+                                                    size_t size) {
+  if (size < FilterHeader::serialized_size) {
+    throw std::runtime_error("truncated filter header");
+  }
+  FilterHeader header = serialization::decode_header(data);
+  check_header(header);
+  if (size - FilterHeader::serialized_size < header.payload_size) {
+    throw std::runtime_error("truncated filter payload");
+  }
+  load_payload(header, data + FilterHeader::serialized_size);
+}
+
+template <typename T, typename Allocator>
+inline void
+CuckooFilter<T, Allocator>::load_payload(const FilterHeader& header,
+                                         const uint8_t* payload) {
+  m_pending.clear();
+  // a delta marks only the runs it copies dirty, so patching a tracked
+  // filter doesn't turn its next delta into a full one
+  if (header.format == SerializationFormat::Delta) {
+    serialization::decode_delta(
+      payload, payload + header.payload_size, m_data.data(),
+      m_occupancy.empty() ? nullptr : m_occupancy.data(), m_bucket_count,
+      m_bucket_size, m_fingerprint_size,
+      [this](size_t first, size_t count) { mark_dirty(first, count); });
+    m_size = header.size;
+    return;
+  }
+  if (header.format == SerializationFormat::Raw) {
+    mark_all_dirty();
+    if (payload != m_data.data()) {
+      std::copy(payload, payload + m_data.size(), m_data.begin());
+    }
+    if (!m_occupancy.empty()) {
+      serialization::rebuild_occupancy(m_data.data(), m_occupancy.data(),
+                                       m_bucket_count, m_bucket_size,
+                                       m_fingerprint_size);
+    }
+    m_size = header.size;
+    return;
+  }
+
+  clear();
+  size_t items;
+  try {
+    items = serialization::decode_compact(
+      payload, payload + header.payload_size, m_data.data(),
+      m_occupancy.empty() ? nullptr : m_occupancy.data(), m_bucket_count,
+      m_bucket_size, m_fingerprint_size);
+  } catch (...) {
+    // the buckets before the malformed record are decoded already
+    clear();
+    throw;
+  }
+  if (items != header.size) {
+    clear();
+    throw std::runtime_error("malformed filter payload");
+  }
+  m_size = header.size;
+}
+
+template <typename T, typename Allocator>
+inline size_t CuckooFilter<T, Allocator>::dirty_block_buckets() const {
+  return std::max<size_t>(1, dirty_block_bytes
+                               / (m_bucket_size * m_fingerprint_size));
+}
+
+// start tracking modifications from a clean state
+template <typename T, typename Allocator>
+inline void CuckooFilter<T, Allocator>::track_dirty() {
+  size_t blocks = (m_bucket_count + dirty_block_buckets() - 1)
+                  / dirty_block_buckets();
+  m_dirty.assign((blocks + 63) / 64, 0);
+}
+
+// mark the blocks of the buckets [first, first + count) dirty, if
+// modifications are tracked at all
+template <typename T, typename Allocator>
+inline void CuckooFilter<T, Allocator>::mark_dirty(size_t first,
+                                                   size_t count) {
+  if (m_dirty.empty() || count == 0) {
+    return;
+  }
+  size_t last = (first + count - 1) / dirty_block_buckets();
+  for (size_t block = first / dirty_block_buckets(); block <= last; block++) {
+    m_dirty[block / 64] |= uint64_t(1) << block % 64;
+  }
+}
+
+// mark all blocks dirty, if modifications are tracked at all
+template <typename T, typename Allocator>
+inline void CuckooFilter<T, Allocator>::mark_all_dirty() {
+  std::fill(m_dirty.begin(), m_dirty.end(), ~uint64_t(0));
+}
+
+template <typename T, typename Allocator>
+inline size_t CuckooFilter<T, Allocator>::checkpoint(std::ostream& out) {
+  serialize(out, false);
+  if (!out) {
+    throw std::runtime_error("can't write the filter checkpoint");
+  }
+  track_dirty();
+  return FilterHeader::serialized_size + m_data.size();
+}
+
+template <typename T, typename Allocator>
+inline size_t CuckooFilter<T, Allocator>::checkpoint_delta(std::ostream& out) {
+  if (m_dirty.empty()) {
+    throw std::runtime_error("no checkpoint to write a delta for");
+  }
+  if (!m_pending.empty()) {
+    throw std::runtime_error("can't serialize pending fingerprints");
+  }
+  // adjacent dirty blocks go into one run
+  size_t block_buckets = dirty_block_buckets();
+  size_t bucket_bytes = m_bucket_size * m_fingerprint_size;
+  std::vector<uint8_t> payload;
+  size_t written = 0; // end of the previous run in buckets
+  size_t first = 0;
+  size_t last = 0;
+  auto flush = [&] {
+    if (last > first) {
+      serialization::append_delta_run(payload, m_data.data(), first - written,
+                                      first, last - first, bucket_bytes);
+      written = last;
+    }
+  };
+  for (size_t word = 0; word < m_dirty.size(); word++) {
+    for (uint64_t bits = m_dirty[word]; bits != 0; bits &= bits - 1) {
+      size_t block = word * 64 + __builtin_ctzll(bits);
+      size_t begin = block * block_buckets;
+      if (begin >= m_bucket_count) {
+        break;
+      }
+      if (begin != last) {
+        flush();
+        first = begin;
+      }
+      last = std::min(begin + block_buckets, m_bucket_count);
+    }
+  }
+  flush();
+
+  FilterHeader header = get_header();
+  header.format = SerializationFormat::Delta;
+  header.payload_size = payload.size();
+  serialization::write_header(out, header);
+  out.write(reinterpret_cast<const char*>(payload.data()), payload.size());
+  if (!out) {
+    throw std::runtime_error("can't write the filter delta");
+  }
+  // only now, a delta that wasn't written leaves its blocks to the next one
+  std::fill(m_dirty.begin(), m_dirty.end(), 0);
+  return FilterHeader::serialized_size + payload.size();
+}
+
+template <typename T, typename Allocator>
+inline void CuckooFilter<T, Allocator>::restore(std::istream& in) {
+  // deltas only make sense on top of the checkpoint they were taken after
+  FilterHeader header = serialization::read_header(in);
+  if (header.format == SerializationFormat::Delta) {
+    throw std::runtime_error("log doesn't start with a checkpoint");
+  }
+  read_payload(in, header);
+  while (in.peek() != std::char_traits<char>::eof()) {
+    deserialize(in);
+  }
+  // the filter is now what the log holds
+  track_dirty();
+}
+
+// Compares chunks of buckets with memcmp, which libc vectorizes, and only
+// the buckets of differing chunks one by one
+template <typename T, typename Allocator>
+template <typename OtherAllocator>
+inline std::vector<uint8_t> CuckooFilter<T, Allocator>::diff(
+  const CuckooFilter<T, OtherAllocator>& old) const {
+  check_header(old.get_header());
+  if (!m_pending.empty()) {
+    throw std::runtime_error("can't serialize pending fingerprints");
+  }
+  size_t bucket_bytes = m_bucket_size * m_fingerprint_size;
+  size_t chunk_buckets = std::max<size_t>(1, 256 / bucket_bytes);
+  const uint8_t* data = m_data.data();
+  const uint8_t* old_data = old.m_data.data();
+
+  std::vector<uint8_t> out(FilterHeader::serialized_size);
+  size_t written = 0; // end of the previous run in buckets
+  size_t first = 0;
+  size_t last = 0;
+  auto flush = [&] {
+    if (last > first) {
+      serialization::append_delta_run(out, data, first - written, first,
+                                      last - first, bucket_bytes);
+      written = last;
+    }
+  };
+  for (size_t chunk = 0; chunk < m_bucket_count; chunk += chunk_buckets) {
+    size_t end = std::min(chunk + chunk_buckets, m_bucket_count);
+    if (std::memcmp(data + chunk * bucket_bytes,
+                    old_data + chunk * bucket_bytes,
+                    (end - chunk) * bucket_bytes)
+        == 0) {
+      continue;
+    }
+    for (size_t index = chunk; index < end; index++) {
+      if (std::memcmp(data + index * bucket_bytes,
+                      old_data + index * bucket_bytes, bucket_bytes)
+          == 0) {
+        continue;
+      }
+      if (index != last) {
+        flush();
+        first = index;
+      }
+      last = index + 1;
+    }
+  }
+  flush();
+
+  FilterHeader header = get_header();
+  header.format = SerializationFormat::Delta;
+  header.payload_size = out.size() - FilterHeader::serialized_size;
+  serialization::encode_header(header, out.data());
+  return out;
+}
+
+template <typename T, typename Allocator>
+inline void
+CuckooFilter<T, Allocator>::patch(const std::vector<uint8_t>& diff) {
+  if (diff.size() < FilterHeader::serialized_size
+      || serialization::decode_header(diff.data()).format
+           != SerializationFormat::Delta) {
+    throw std::runtime_error("not a filter diff");
+  }
+  deserialize(diff.data(), diff.size());
 }
 
-template <typename T>
-inline void CuckooFilter<T>::memory_usage_info() const {
+template <typename T, typename Allocator>
+inline void CuckooFilter<T, Allocator>::memory_usage_info() const {
   std::cerr << "== CuckooFilter memory usage broken up: ==" << std::endl;
-  std::cerr << "sizeof CuckooFilter struct: " << sizeof(CuckooFilter<T>) << "B"
-            << std::endl;
+  std::cerr << "sizeof CuckooFilter struct: "
+            << sizeof(CuckooFilter<T, Allocator>) << "B" << std::endl;
   std::cerr << "number of buckets: " << m_bucket_count << std::endl;
   std::cerr << "single bucket memory usage: "
             << sizeof(uint8_t) * m_bucket_size * m_fingerprint_size << "B"
             << std::endl;
+  std::cerr << "occupancy bitmaps: " << sizeof(uint8_t) * m_occupancy.size()
+            << "B" << std::endl;
   std::cerr << "==========================================" << std::endl;
 }
 
-template <typename T>
+template <typename T, typename Allocator>
 inline std::ostream& operator<<(std::ostream& out,
-                                const CuckooFilter<T>& filter) {
+                                const CuckooFilter<T, Allocator>& filter) {
   out << "{" << std::hex << std::endl;
   for (size_t bucket_index = 0; bucket_index < filter.m_bucket_count;
        bucket_index++) {
@@ -302,4 +1127,69 @@ inline std::ostream& operator<<(std::ostream& out,
   return out;
 }
 
+// Estimate the number of items in both a and b, two filters of the same
+// geometry and hash functions, from the fingerprints they share. An item of
+// both is in one of its two buckets in either filter, so every fingerprint
+// of a is looked up in the same bucket of b first and in its alternate
+// bucket only if missing there. Fingerprints of distinct items match as
+// well, which is corrected for by their expected number at b's load.
+// Pending fingerprints are left out. Throws std::runtime_error on
+// mismatching geometry.
+template <typename T, typename A, typename B>
+inline double estimate_intersection(const CuckooFilter<T, A>& a,
+                                    const CuckooFilter<T, B>& b) {
+  a.check_header(b.get_header());
+  size_t fingerprint_size = a.m_fingerprint_size;
+  size_t bucket_size = a.m_bucket_size;
+  size_t bucket_bytes = bucket_size * fingerprint_size;
+  auto in_b = [&](size_t index, uint64_t fingerprint) {
+    const uint8_t* bucket = b.m_data.data() + index * bucket_bytes;
+    for (size_t slot = 0; slot < bucket_size; slot++) {
+      if (serialization::get_le(bucket + slot * fingerprint_size,
+                                fingerprint_size)
+          == fingerprint) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  size_t fingerprints = 0;
+  size_t matches = 0;
+  for (size_t index = 0; index < a.m_bucket_count; index++) {
+    const uint8_t* bucket = a.m_data.data() + index * bucket_bytes;
+    for (size_t slot = 0; slot < bucket_size; slot++) {
+      uint64_t fingerprint = serialization::get_le(
+        bucket + slot * fingerprint_size, fingerprint_size);
+      if (fingerprint == 0) {
+        continue;
+      }
+      fingerprints++;
+      matches += in_b(index, fingerprint)
+                 || in_b(a.get_alt_index(index,
+                                         static_cast<uint32_t>(fingerprint)),
+                         fingerprint);
+    }
+  }
+  if (fingerprints == 0) {
+    return 0;
+  }
+  // chance of a fingerprint to be among b's in two buckets by coincidence
+  double values = std::ldexp(1.0, static_cast<int>(8 * fingerprint_size)) - 1;
+  double chance = std::min(0.5, 2 * bucket_size * b.load_factor() / values);
+  double estimate = (matches - fingerprints * chance) / (1 - chance);
+  double bound = static_cast<double>(std::min(fingerprints, b.size()));
+  return std::max(0.0, std::min(estimate, bound));
+}
+
+// Estimate the Jaccard similarity, i.e. intersection over union, of the item
+// sets of two filters as for estimate_intersection, 0 if both are empty
+template <typename T, typename A, typename B>
+inline double estimate_jaccard(const CuckooFilter<T, A>& a,
+                               const CuckooFilter<T, B>& b) {
+  double intersection = estimate_intersection(a, b);
+  double united = a.size() + b.size() - intersection;
+  return united > 0 ? intersection / united : 0;
+}
+
 } // namespace cuculiform
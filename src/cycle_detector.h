@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace cuculiform {
+
+// CycleDetector watches the buckets visited by a relocation chain and tells
+// when the chain is evidently trapped, i.e. keeps bouncing among a small set
+// of buckets whose fingerprints have nowhere else to go. This happens when the
+// filter is close to saturation and would otherwise only be noticed after all
+// max_relocations kicks have been spent.
+//
+// Only the first few distinct buckets are remembered. A chain that visits
+// more than that is exploring the table and is left alone.
+class CycleDetector {
+public:
+  static constexpr size_t max_visited = 16;
+
+  // patience is the number of revisits per remembered bucket that are
+  // tolerated without discovering a new bucket
+  explicit CycleDetector(size_t patience)
+      : m_patience(patience), m_count(0), m_revisits(0), m_overflowed(false) {
+  }
+
+  // Record a visit of the bucket with the given index.
+  // Returns true if the chain should be aborted.
+  bool visit(size_t index);
+
+private:
+  size_t m_patience;
+  size_t m_visited[max_visited];
+  size_t m_count;    // number of distinct buckets in m_visited
+  size_t m_revisits; // revisits since the last new bucket
+  bool m_overflowed; // more distinct buckets than fit into m_visited
+};
+
+inline bool CycleDetector::visit(size_t index) {
+  if (m_overflowed) {
+    return false;
+  }
+  for (size_t i = 0; i < m_count; i++) {
+    if (m_visited[i] == index) {
+      m_revisits++;
+      return m_revisits > m_patience * m_count;
+    }
+  }
+  if (m_count == max_visited) {
+    m_overflowed = true;
+    return false;
+  }
+  m_visited[m_count++] = index;
+  m_revisits = 0;
+  return false;
+}
+
+} // namespace cuculiform
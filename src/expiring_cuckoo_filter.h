@@ -0,0 +1,354 @@
+#pragma once
+
+#include <algorithm>
+#include <assert.h>
+#include <functional>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#include "bucket.h"
+#include "util.h"
+
+namespace cuculiform {
+
+// ExpiringCuckooFilter is a Cuckoo filter whose entries expire after a number
+// of epochs, so a single filter serves a sliding time horizon at constant
+// memory. It is the alternative to WindowedCuckooFilter's generations.
+//
+// The lowest epoch_bits bits of every slot are stolen from the fingerprint
+// and hold the epoch the entry has been inserted in, modulo 2^epoch_bits.
+// Entries that are ttl or more epochs old are treated as empty: lookups skip
+// them and inserts overwrite them. As relocation moves whole slots, an entry
+// keeps its epoch when it is kicked to its other bucket.
+//
+// To tell ages apart across the wraparound of the epoch counter, expired
+// entries are physically reclaimed within the epoch they expire in. Every
+// insert sweeps a few buckets, sweep() can be called from idle time to do
+// more, and advance_epoch() sweeps whatever is left of the current pass.
+// None of this is thread-safe.
+template <typename T>
+class ExpiringCuckooFilter {
+public:
+  // number of buckets swept per insert
+  static constexpr size_t sweep_step = 8;
+
+  // Entries inserted in epoch e are found in epochs e to e + ttl - 1.
+  // ttl has to be below 2^epoch_bits, and epoch_bits leave at least 4 bits of
+  // fingerprint.
+  explicit ExpiringCuckooFilter(
+    size_t capacity, size_t fingerprint_size, size_t ttl,
+    size_t epoch_bits = 4, uint max_relocations = 500, size_t bucket_size = 4,
+    std::function<uint64_t(size_t)> cuckoo_hash_fn = cuculiform::CityHash{},
+    std::function<uint64_t(size_t)> fingerprint_hash_fn =
+      cuculiform::CityHash{})
+      : m_size(0),
+        m_capacity(capacity),
+        m_bucket_size(bucket_size),
+        m_bucket_count(ceil_to_power_of_two(m_capacity / m_bucket_size)),
+        m_fingerprint_size(fingerprint_size),
+        m_epoch_bits(epoch_bits),
+        m_ttl(ttl),
+        m_max_relocations(max_relocations),
+        m_cuckoo_hash_fn(cuckoo_hash_fn),
+        m_fingerprint_hash_fn(fingerprint_hash_fn),
+        m_epoch(0),
+        m_sweep_cursor(0),
+        m_gen(std::random_device{}()),
+        m_index_dis(0, 1),
+        m_bucket_dis(0, m_bucket_size - 1) {
+    assert(m_fingerprint_size > 0);
+    assert(m_fingerprint_size <= 4);
+    assert(m_epoch_bits > 0);
+    assert(m_epoch_bits + 4 <= m_fingerprint_size * 8);
+    assert(m_ttl > 0);
+    assert(m_ttl < (size_t(1) << m_epoch_bits));
+
+    m_data = std::vector<uint8_t>(
+      m_bucket_count * m_bucket_size * m_fingerprint_size, 0);
+  }
+
+  // Insert item in the current epoch. Like CuckooFilter, every insert stores
+  // an entry of its own, as other items may share the fingerprint. Inserting
+  // an item again extends its lifetime, as the newer entry lives longer.
+  bool insert(const T item);
+  // true if item has been inserted less than ttl epochs ago
+  bool contains(const T item) const;
+  bool erase(const T item);
+  // Move on to the next epoch, completing the current sweep pass first
+  void advance_epoch();
+  // Reclaim expired entries of up to buckets more buckets of the current
+  // pass. Returns the number of reclaimed entries.
+  size_t sweep(size_t buckets);
+  void clear();
+  // number of stored entries, including expired ones not yet swept
+  size_t size() const;
+  size_t capacity() const;
+  size_t epoch() const;
+  size_t ttl() const;
+  size_t memory_usage() const;
+
+private:
+  size_t m_size;
+  std::vector<uint8_t> m_data; // entries, bucket after bucket
+  const size_t m_capacity;     // total number of fingerprints in the filter
+  const size_t m_bucket_size;  // number of fingerprints that fit in a bucket
+  const size_t m_bucket_count; // number of buckets in the filter
+  const size_t m_fingerprint_size; // size of a slot in bytes
+  const size_t m_epoch_bits;       // bits of a slot used for the epoch
+  const size_t m_ttl;              // lifetime of entries in epochs
+  const uint m_max_relocations;    // max number of relocations before filled
+  const std::function<uint64_t(size_t)>
+    m_cuckoo_hash_fn; // hash function used for partial cuckoo hashing
+  const std::function<uint64_t(size_t)>
+    m_fingerprint_hash_fn; // hash function used for fingerprinting
+  size_t m_epoch;
+  size_t m_sweep_cursor; // buckets swept in the current epoch
+  std::mt19937 m_gen;
+  std::uniform_int_distribution<> m_index_dis;
+  std::uniform_int_distribution<> m_bucket_dis;
+
+  uint32_t get_fingerprint(const T& item) const;
+  std::pair<size_t, size_t> get_indexes(const T& item,
+                                        const uint32_t fingerprint) const;
+  size_t get_alt_index(const size_t index, const uint32_t fingerprint) const;
+
+  Bucket get_bucket(const size_t index);
+  ConstBucket get_bucket(const size_t index) const;
+  uint32_t make_entry(const uint32_t fingerprint) const;
+  // false for empty and expired entries
+  bool is_live(const uint32_t entry) const;
+  bool insert_into_bucket(const size_t index, const uint32_t entry);
+  // slot in bucket index of a live entry of fingerprint or npos
+  size_t find_in_bucket(const size_t index, const uint32_t fingerprint) const;
+
+  static constexpr size_t npos = static_cast<size_t>(-1);
+};
+
+template <typename T>
+constexpr size_t ExpiringCuckooFilter<T>::sweep_step;
+
+template <typename T>
+constexpr size_t ExpiringCuckooFilter<T>::npos;
+
+template <typename T>
+inline uint32_t ExpiringCuckooFilter<T>::get_fingerprint(const T& item) const {
+  // same normalization as CuckooFilter, see there
+  std::hash<T> weak_hash_fn;
+  uint64_t fingerprint = m_fingerprint_hash_fn(weak_hash_fn(item));
+
+  // only use the slot bits not taken by the epoch
+  fingerprint >>= sizeof(fingerprint) * 8
+                  - (m_fingerprint_size * 8 - m_epoch_bits);
+  if (fingerprint == 0) {
+    fingerprint = 1;
+  }
+  return static_cast<uint32_t>(fingerprint);
+}
+
+template <typename T>
+inline size_t
+ExpiringCuckooFilter<T>::get_alt_index(const size_t index,
+                                       const uint32_t fingerprint) const {
+  // partial-key cuckoo hashing on the fingerprint without its epoch
+  return index
+         ^ (static_cast<uint32_t>(m_cuckoo_hash_fn(fingerprint))
+            % m_bucket_count);
+}
+
+template <typename T>
+inline std::pair<size_t, size_t>
+ExpiringCuckooFilter<T>::get_indexes(const T& item,
+                                     const uint32_t fingerprint) const {
+  std::hash<T> weak_hash_fn;
+  size_t index = m_cuckoo_hash_fn(weak_hash_fn(item)) % m_bucket_count;
+  return std::make_pair(index, get_alt_index(index, fingerprint));
+}
+
+template <typename T>
+inline Bucket ExpiringCuckooFilter<T>::get_bucket(const size_t index) {
+  uint8_t* begin = m_data.data() + index * m_bucket_size * m_fingerprint_size;
+  return Bucket(begin, begin + m_bucket_size * m_fingerprint_size,
+                m_fingerprint_size);
+}
+
+template <typename T>
+inline ConstBucket
+ExpiringCuckooFilter<T>::get_bucket(const size_t index) const {
+  const uint8_t* begin =
+    m_data.data() + index * m_bucket_size * m_fingerprint_size;
+  return ConstBucket(begin, begin + m_bucket_size * m_fingerprint_size,
+                     m_fingerprint_size);
+}
+
+template <typename T>
+inline uint32_t
+ExpiringCuckooFilter<T>::make_entry(const uint32_t fingerprint) const {
+  uint32_t epoch_mask = (uint32_t(1) << m_epoch_bits) - 1;
+  return fingerprint << m_epoch_bits | (m_epoch & epoch_mask);
+}
+
+template <typename T>
+inline bool ExpiringCuckooFilter<T>::is_live(const uint32_t entry) const {
+  if (entry == 0) {
+    return false;
+  }
+  uint32_t epoch_mask = (uint32_t(1) << m_epoch_bits) - 1;
+  size_t age = (m_epoch - (entry & epoch_mask)) & epoch_mask;
+  return age < m_ttl;
+}
+
+template <typename T>
+inline bool ExpiringCuckooFilter<T>::insert_into_bucket(const size_t index,
+                                                        const uint32_t entry) {
+  auto bucket = get_bucket(index);
+  for (size_t slot = 0; slot < m_bucket_size; slot++) {
+    uint32_t stored = bucket.get(slot);
+    if (!is_live(stored)) {
+      // reclaim expired entries opportunistically
+      if (stored != 0) {
+        m_size--;
+      }
+      bucket.set(slot, entry);
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename T>
+inline size_t
+ExpiringCuckooFilter<T>::find_in_bucket(const size_t index,
+                                        const uint32_t fingerprint) const {
+  auto bucket = get_bucket(index);
+  for (size_t slot = 0; slot < m_bucket_size; slot++) {
+    uint32_t stored = bucket.get(slot);
+    if (stored >> m_epoch_bits == fingerprint && is_live(stored)) {
+      return slot;
+    }
+  }
+  return npos;
+}
+
+template <typename T>
+inline bool ExpiringCuckooFilter<T>::insert(const T item) {
+  sweep(sweep_step);
+
+  uint32_t fingerprint = get_fingerprint(item);
+  size_t index;
+  size_t alt_index;
+  std::tie(index, alt_index) = get_indexes(item, fingerprint);
+
+  uint32_t entry = make_entry(fingerprint);
+  size_t index_to_insert = m_index_dis(m_gen) ? index : alt_index;
+  if (insert_into_bucket(index_to_insert, entry)
+      || insert_into_bucket(index_to_insert ^ index ^ alt_index, entry)) {
+    m_size++;
+    return true;
+  }
+
+  // relocate whole entries, so they keep their epoch
+  index_to_insert = index_to_insert ^ index ^ alt_index;
+  for (uint i = 0; i < m_max_relocations; i++) {
+    auto bucket = get_bucket(index_to_insert);
+    size_t slot = m_bucket_dis(m_gen);
+    uint32_t victim = bucket.get(slot);
+    bucket.set(slot, entry);
+    entry = victim;
+
+    index_to_insert = get_alt_index(index_to_insert, entry >> m_epoch_bits);
+    if (insert_into_bucket(index_to_insert, entry)) {
+      m_size++;
+      return true;
+    }
+  }
+
+  // like CuckooFilter, the last victim is thrown out
+  return false;
+}
+
+template <typename T>
+inline bool ExpiringCuckooFilter<T>::contains(const T item) const {
+  uint32_t fingerprint = get_fingerprint(item);
+  size_t index;
+  size_t alt_index;
+  std::tie(index, alt_index) = get_indexes(item, fingerprint);
+  return find_in_bucket(index, fingerprint) != npos
+         || find_in_bucket(alt_index, fingerprint) != npos;
+}
+
+template <typename T>
+inline bool ExpiringCuckooFilter<T>::erase(const T item) {
+  uint32_t fingerprint = get_fingerprint(item);
+  size_t index;
+  size_t alt_index;
+  std::tie(index, alt_index) = get_indexes(item, fingerprint);
+  for (size_t bucket_index : {index, alt_index}) {
+    size_t slot = find_in_bucket(bucket_index, fingerprint);
+    if (slot != npos) {
+      get_bucket(bucket_index).set(slot, 0);
+      m_size--;
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename T>
+inline void ExpiringCuckooFilter<T>::advance_epoch() {
+  sweep(m_bucket_count);
+  m_epoch++;
+  m_sweep_cursor = 0;
+}
+
+template <typename T>
+inline size_t ExpiringCuckooFilter<T>::sweep(size_t buckets) {
+  size_t end = std::min(m_bucket_count, m_sweep_cursor + buckets);
+  size_t reclaimed = 0;
+  for (size_t index = m_sweep_cursor; index < end; index++) {
+    auto bucket = get_bucket(index);
+    for (size_t slot = 0; slot < m_bucket_size; slot++) {
+      uint32_t stored = bucket.get(slot);
+      if (stored != 0 && !is_live(stored)) {
+        bucket.set(slot, 0);
+        reclaimed++;
+      }
+    }
+  }
+  m_sweep_cursor = end;
+  m_size -= reclaimed;
+  return reclaimed;
+}
+
+template <typename T>
+inline void ExpiringCuckooFilter<T>::clear() {
+  std::fill(std::begin(m_data), std::end(m_data), 0);
+  m_size = 0;
+}
+
+template <typename T>
+inline size_t ExpiringCuckooFilter<T>::size() const {
+  return m_size;
+}
+
+template <typename T>
+inline size_t ExpiringCuckooFilter<T>::capacity() const {
+  return m_capacity;
+}
+
+template <typename T>
+inline size_t ExpiringCuckooFilter<T>::epoch() const {
+  return m_epoch;
+}
+
+template <typename T>
+inline size_t ExpiringCuckooFilter<T>::ttl() const {
+  return m_ttl;
+}
+
+template <typename T>
+inline size_t ExpiringCuckooFilter<T>::memory_usage() const {
+  return sizeof(ExpiringCuckooFilter<T>) + sizeof(uint8_t) * m_data.size();
+}
+
+} // namespace cuculiform
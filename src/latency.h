@@ -0,0 +1,371 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdint.h>
+#include <vector>
+
+namespace cuculiform {
+
+// Histogram of latencies in nanoseconds with log-linear buckets like
+// HdrHistogram: values below 64 are counted exactly, above that every power
+// of two is split into 32 buckets, so any recorded value is reported with a
+// relative error below 1/32. Values from about 18 minutes on share the last
+// bucket. Histograms of different threads or runs can be merged.
+class LatencyHistogram {
+public:
+  static constexpr size_t sub_bucket_bits = 5;
+  static constexpr size_t max_magnitude = 40;
+  static constexpr size_t bucket_count =
+    (max_magnitude - sub_bucket_bits + 1) << sub_bucket_bits;
+
+  LatencyHistogram()
+      : m_counts(size_t(bucket_count), 0), m_count(0), m_sum(0), m_max(0) {
+  }
+
+  void record(uint64_t nanoseconds, uint64_t count = 1) {
+    m_counts[index_of(nanoseconds)] += count;
+    m_count += count;
+    m_sum += nanoseconds * count;
+    m_max = std::max(m_max, nanoseconds);
+  }
+  void merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < bucket_count; i++) {
+      m_counts[i] += other.m_counts[i];
+    }
+    m_count += other.m_count;
+    m_sum += other.m_sum;
+    m_max = std::max(m_max, other.m_max);
+  }
+  void clear() {
+    std::fill(m_counts.begin(), m_counts.end(), 0);
+    m_count = 0;
+    m_sum = 0;
+    m_max = 0;
+  }
+
+  uint64_t count() const {
+    return m_count;
+  }
+  uint64_t max() const {
+    return m_max;
+  }
+  double mean() const {
+    return m_count == 0 ? 0 : static_cast<double>(m_sum) / m_count;
+  }
+  // largest value of the bucket holding the given percentile in [0, 100],
+  // at most the maximum recorded
+  uint64_t percentile(double percentile) const;
+
+  // one line of count, mean and common percentiles
+  void write_text(std::ostream& out) const;
+  void write_json(std::ostream& out) const;
+
+  static size_t index_of(uint64_t value) {
+    if (value < (uint64_t(2) << sub_bucket_bits)) {
+      return static_cast<size_t>(value);
+    }
+    size_t magnitude = 63 - __builtin_clzll(value);
+    if (magnitude >= max_magnitude) {
+      return bucket_count - 1;
+    }
+    size_t shift = magnitude - sub_bucket_bits;
+    return ((magnitude - sub_bucket_bits) << sub_bucket_bits)
+           + static_cast<size_t>(value >> shift);
+  }
+  // smallest value counted in the bucket with the given index
+  static uint64_t value_of(size_t index) {
+    if (index < (size_t(2) << sub_bucket_bits)) {
+      return index;
+    }
+    size_t magnitude = (index >> sub_bucket_bits) + sub_bucket_bits - 1;
+    uint64_t sub_bucket =
+      (index & ((size_t(1) << sub_bucket_bits) - 1))
+      + (uint64_t(1) << sub_bucket_bits);
+    return sub_bucket << (magnitude - sub_bucket_bits);
+  }
+
+  template <size_t>
+  friend class ThreadLatencies;
+
+private:
+  std::vector<uint64_t> m_counts;
+  uint64_t m_count;
+  uint64_t m_sum;
+  uint64_t m_max;
+};
+
+inline uint64_t LatencyHistogram::percentile(double percentile) const {
+  if (m_count == 0) {
+    return 0;
+  }
+  uint64_t rank = static_cast<uint64_t>(percentile / 100 * (m_count - 1));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < bucket_count; i++) {
+    seen += m_counts[i];
+    if (seen > rank) {
+      return i + 1 < bucket_count ? std::min(value_of(i + 1) - 1, m_max)
+                                  : m_max;
+    }
+  }
+  return m_max;
+}
+
+inline void LatencyHistogram::write_text(std::ostream& out) const {
+  out << "count " << m_count << ", mean " << mean() << "ns, p50 "
+      << percentile(50) << "ns, p90 " << percentile(90) << "ns, p99 "
+      << percentile(99) << "ns, p99.9 " << percentile(99.9) << "ns, p99.99 "
+      << percentile(99.99) << "ns, max " << m_max << "ns";
+}
+
+inline void LatencyHistogram::write_json(std::ostream& out) const {
+  out << "{\"count\": " << m_count << ", \"mean\": " << mean()
+      << ", \"max\": " << m_max << ", \"percentiles\": {";
+  const double percentiles[] = {50, 90, 99, 99.9, 99.99};
+  for (size_t i = 0; i < 5; i++) {
+    out << (i > 0 ? ", " : "") << "\"" << percentiles[i]
+        << "\": " << percentile(percentiles[i]);
+  }
+  // only non-empty buckets, as [lowest value, count]
+  out << "}, \"buckets\": [";
+  bool first = true;
+  for (size_t i = 0; i < bucket_count; i++) {
+    if (m_counts[i] != 0) {
+      out << (first ? "" : ", ") << "[" << value_of(i) << ", " << m_counts[i]
+          << "]";
+      first = false;
+    }
+  }
+  out << "]}";
+}
+
+namespace latency {
+
+// operation types latencies are recorded for
+enum class Operation : uint8_t {
+  InsertDirect = 0,    // insert that found a free slot in one of its buckets
+  InsertRelocated = 1, // insert that kicked out fingerprints, failed or not
+  Contains = 2,
+  Erase = 3,
+};
+constexpr size_t operation_count = 4;
+
+inline const char* operation_name(Operation operation) {
+  static const char* names[] = {"insert_direct", "insert_relocated",
+                                "contains", "erase"};
+  return names[static_cast<size_t>(operation)];
+}
+
+// Latencies of every operation type, e.g. merged over all threads
+class Latencies {
+public:
+  LatencyHistogram& operator[](Operation operation) {
+    return m_histograms[static_cast<size_t>(operation)];
+  }
+  const LatencyHistogram& operator[](Operation operation) const {
+    return m_histograms[static_cast<size_t>(operation)];
+  }
+  void merge(const Latencies& other) {
+    for (size_t i = 0; i < operation_count; i++) {
+      m_histograms[i].merge(other.m_histograms[i]);
+    }
+  }
+  // one line per operation type
+  void write_text(std::ostream& out) const {
+    for (size_t i = 0; i < operation_count; i++) {
+      out << operation_name(static_cast<Operation>(i)) << ": ";
+      m_histograms[i].write_text(out);
+      out << "\n";
+    }
+  }
+  void write_json(std::ostream& out) const {
+    out << "{";
+    for (size_t i = 0; i < operation_count; i++) {
+      out << (i > 0 ? ", " : "") << "\""
+          << operation_name(static_cast<Operation>(i)) << "\": ";
+      m_histograms[i].write_json(out);
+    }
+    out << "}";
+  }
+
+private:
+  LatencyHistogram m_histograms[operation_count];
+};
+
+} // namespace latency
+
+// Histograms a single thread records into. Counters are atomics written
+// with relaxed loads and stores only, which is as cheap as plain memory
+// accesses with a single writer, so other threads can take snapshots.
+template <size_t OperationCount>
+class ThreadLatencies {
+public:
+  ThreadLatencies() {
+    for (auto& histogram : m_histograms) {
+      for (auto& count : histogram.counts) {
+        count.store(0, std::memory_order_relaxed);
+      }
+      histogram.sum.store(0, std::memory_order_relaxed);
+      histogram.max.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  void record(size_t operation, uint64_t nanoseconds) {
+    Histogram& histogram = m_histograms[operation];
+    increment(histogram.counts[LatencyHistogram::index_of(nanoseconds)], 1);
+    increment(histogram.sum, nanoseconds);
+    if (nanoseconds > histogram.max.load(std::memory_order_relaxed)) {
+      histogram.max.store(nanoseconds, std::memory_order_relaxed);
+    }
+  }
+  void add_to(latency::Latencies& latencies) const {
+    for (size_t i = 0; i < OperationCount; i++) {
+      LatencyHistogram& target =
+        latencies[static_cast<latency::Operation>(i)];
+      const Histogram& histogram = m_histograms[i];
+      for (size_t j = 0; j < LatencyHistogram::bucket_count; j++) {
+        uint64_t count = histogram.counts[j].load(std::memory_order_relaxed);
+        target.m_counts[j] += count;
+        target.m_count += count;
+      }
+      target.m_sum += histogram.sum.load(std::memory_order_relaxed);
+      target.m_max = std::max(
+        target.m_max, histogram.max.load(std::memory_order_relaxed));
+    }
+  }
+  void clear() {
+    for (auto& histogram : m_histograms) {
+      for (auto& count : histogram.counts) {
+        count.store(0, std::memory_order_relaxed);
+      }
+      histogram.sum.store(0, std::memory_order_relaxed);
+      histogram.max.store(0, std::memory_order_relaxed);
+    }
+  }
+
+private:
+  struct Histogram {
+    std::atomic<uint64_t> counts[LatencyHistogram::bucket_count];
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+  };
+  Histogram m_histograms[OperationCount];
+
+  static void increment(std::atomic<uint64_t>& counter, uint64_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+                  std::memory_order_relaxed);
+  }
+};
+
+namespace latency {
+
+using ThreadHistograms = ThreadLatencies<operation_count>;
+
+// Histograms of all threads that ever recorded, kept beyond their exit
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::shared_ptr<ThreadHistograms>> threads;
+  // record every n-th operation of a thread, 0 disables recording
+  std::atomic<size_t> sample_interval{1};
+};
+
+inline Registry& registry() {
+  static Registry registry;
+  return registry;
+}
+
+inline ThreadHistograms& thread_histograms() {
+  thread_local std::shared_ptr<ThreadHistograms> histograms = [] {
+    auto histograms = std::make_shared<ThreadHistograms>();
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    registry().threads.push_back(histograms);
+    return histograms;
+  }();
+  return *histograms;
+}
+
+// Record only every interval-th operation of every thread, 0 disables
+// recording. Defaults to 1, i.e. every operation.
+inline void set_sample_interval(size_t interval) {
+  registry().sample_interval.store(interval, std::memory_order_relaxed);
+}
+
+// histograms of all threads merged
+inline Latencies snapshot() {
+  Latencies latencies;
+  std::lock_guard<std::mutex> lock(registry().mutex);
+  for (auto& histograms : registry().threads) {
+    histograms->add_to(latencies);
+  }
+  return latencies;
+}
+
+// Clear the histograms of all threads. Operations in flight on other
+// threads may still be recorded.
+inline void reset() {
+  std::lock_guard<std::mutex> lock(registry().mutex);
+  for (auto& histograms : registry().threads) {
+    histograms->clear();
+  }
+}
+
+// Times its scope and records it for the calling thread if sampled. If
+// relocated is given and set when the scope ends, an insert is recorded as
+// relocated.
+class ScopedTimer {
+public:
+  explicit ScopedTimer(Operation operation, const bool* relocated = nullptr)
+      : m_operation(operation), m_relocated(relocated), m_sampled(false) {
+    thread_local size_t operations = 0;
+    size_t interval =
+      registry().sample_interval.load(std::memory_order_relaxed);
+    if (interval == 0 || ++operations % interval != 0) {
+      return;
+    }
+    m_sampled = true;
+    m_start = std::chrono::steady_clock::now();
+  }
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+  ~ScopedTimer() {
+    if (!m_sampled) {
+      return;
+    }
+    auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - m_start)
+                         .count();
+    Operation operation = m_operation;
+    if (m_relocated != nullptr && *m_relocated) {
+      operation = Operation::InsertRelocated;
+    }
+    thread_histograms().record(static_cast<size_t>(operation),
+                               static_cast<uint64_t>(nanoseconds));
+  }
+
+private:
+  Operation m_operation;
+  const bool* m_relocated;
+  bool m_sampled;
+  std::chrono::steady_clock::time_point m_start;
+};
+
+} // namespace latency
+
+} // namespace cuculiform
+
+// Latency recording in CuckooFilter compiles to nothing unless
+// CUCULIFORM_ENABLE_LATENCY is defined before including cuculiform.h. It
+// switches the bodies of inline templates, so define it for the whole
+// project, e.g. with -DCUCULIFORM_ENABLE_LATENCY, never per translation
+// unit: units disagreeing on it violate the one definition rule, and the
+// linker keeps either variant.
+#ifdef CUCULIFORM_ENABLE_LATENCY
+#define CUCULIFORM_LATENCY_SCOPE(...)                                        \
+  ::cuculiform::latency::ScopedTimer cuculiform_latency_timer(__VA_ARGS__)
+#else
+#define CUCULIFORM_LATENCY_SCOPE(...)
+#endif
@@ -0,0 +1,366 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <stdint.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+// not every libc exposes these, values are from the kernel's uapi headers
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+#ifndef MPOL_INTERLEAVE
+#define MPOL_INTERLEAVE 3
+#endif
+
+namespace cuculiform {
+
+// Page size backing the filter's bucket array.
+// Huge pages greatly reduce TLB misses of random bucket accesses in big
+// filters.
+enum class PageSize {
+  Default,     // regular pages
+  Transparent, // regular mapping, marked for transparent huge pages
+  Huge2M,      // explicit 2 MiB huge pages via MAP_HUGETLB
+  Huge1G,      // explicit 1 GiB huge pages via MAP_HUGETLB
+};
+
+// Placement of the filter's bucket array on NUMA systems
+enum class NumaPlacement {
+  Default,    // first touch, i.e. usually the node of the constructing thread
+  Interleave, // pages round robin across nodes
+  Bind,       // pages only from the given nodes
+};
+
+struct MemoryPolicy {
+  explicit MemoryPolicy(PageSize page_size = PageSize::Transparent,
+                        NumaPlacement numa = NumaPlacement::Default,
+                        uint64_t node_mask = 0)
+      : page_size(page_size), numa(numa), node_mask(node_mask) {
+  }
+
+  PageSize page_size;
+  NumaPlacement numa;
+  // bitmask of nodes 0 to 63 to interleave across or bind to, 0 means all
+  // online nodes, including any beyond 63
+  uint64_t node_mask;
+};
+
+// Zero bytes by handing whole pages back to the kernel, which maps fresh zero
+// pages on the next access. Only valid for private anonymous mappings.
+// Returns false if the kernel refused, e.g. for some huge page mappings.
+inline bool discard_pages(uint8_t* data, size_t n) {
+  uintptr_t page_size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  uintptr_t begin = reinterpret_cast<uintptr_t>(data);
+  uintptr_t end = begin + n;
+  uintptr_t pages_begin = (begin + page_size - 1) / page_size * page_size;
+  uintptr_t pages_end = end / page_size * page_size;
+  if (pages_begin >= pages_end) {
+    return false;
+  }
+  if (madvise(reinterpret_cast<void*>(pages_begin), pages_end - pages_begin,
+              MADV_DONTNEED)
+      != 0) {
+    return false;
+  }
+  std::fill(data, reinterpret_cast<uint8_t*>(pages_begin), 0);
+  std::fill(reinterpret_cast<uint8_t*>(pages_end), data + n, 0);
+  return true;
+}
+
+// Parse a kernel cpu or node list like "0-3,8,10-11"
+inline std::vector<size_t> parse_id_list(const std::string& list) {
+  std::vector<size_t> ids;
+  std::stringstream stream(list);
+  std::string range;
+  while (std::getline(stream, range, ',')) {
+    if (range.empty() || range == "\n") {
+      continue;
+    }
+    size_t first = std::stoul(range);
+    size_t last = first;
+    size_t dash = range.find('-');
+    if (dash != std::string::npos) {
+      last = std::stoul(range.substr(dash + 1));
+    }
+    for (size_t id = first; id <= last; id++) {
+      ids.push_back(id);
+    }
+  }
+  return ids;
+}
+
+// Ids of all online NUMA nodes, just node 0 on systems without NUMA
+inline std::vector<size_t> numa_online_nodes() {
+  std::ifstream file("/sys/devices/system/node/online");
+  std::string list;
+  std::getline(file, list);
+  std::vector<size_t> nodes = parse_id_list(list);
+  if (nodes.empty()) {
+    nodes.push_back(0);
+  }
+  return nodes;
+}
+
+// NUMA node of every CPU, indexed by CPU number
+inline std::vector<size_t> numa_cpu_nodes() {
+  std::vector<size_t> cpu_nodes;
+  for (size_t node : numa_online_nodes()) {
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node)
+                       + "/cpulist");
+    std::string list;
+    std::getline(file, list);
+    for (size_t cpu : parse_id_list(list)) {
+      if (cpu >= cpu_nodes.size()) {
+        cpu_nodes.resize(cpu + 1, 0);
+      }
+      cpu_nodes[cpu] = node;
+    }
+  }
+  return cpu_nodes;
+}
+
+// Allocator placing memory in anonymous mappings according to a MemoryPolicy.
+// Use it as the Allocator of a CuckooFilter, e.g.
+// CuckooFilter<uint64_t, MmapAllocator<uint8_t>> filter{..., allocator}.
+// Huge pages and NUMA placement are applied on a best effort basis: if no
+// explicit huge pages are reserved, transparent huge pages are used instead,
+// and NUMA placement is skipped where the kernel refuses it.
+//
+// Precondition: value-initialization is a no-op, relying on fresh memory
+// being zeroed. That holds for a container that only ever grows into newly
+// allocated storage, like CuckooFilter's bucket array, which is sized once.
+// Elements regrown within a container's capacity, e.g. after shrinking a
+// std::vector with resize, keep their stale bytes instead of being zeroed.
+// Don't use the allocator for containers resized like that.
+template <typename T>
+class MmapAllocator {
+public:
+  using value_type = T;
+
+  explicit MmapAllocator(MemoryPolicy policy = MemoryPolicy())
+      : m_policy(policy) {
+  }
+  template <typename U>
+  MmapAllocator(const MmapAllocator<U>& other) : m_policy(other.policy()) {
+  }
+
+  T* allocate(size_t n);
+  void deallocate(T* pointer, size_t n);
+
+  // anonymous mappings are zeroed by the kernel, so value-initialization can
+  // be skipped, which leaves pages untouched until first use
+  template <typename U>
+  void construct(U*) {
+  }
+  template <typename U, typename... Args>
+  void construct(U* pointer, Args&&... args) {
+    ::new (static_cast<void*>(pointer)) U(std::forward<Args>(args)...);
+  }
+
+  const MemoryPolicy& policy() const {
+    return m_policy;
+  }
+
+private:
+  MemoryPolicy m_policy;
+
+  size_t mapping_length(size_t n) const;
+};
+
+template <typename T>
+inline size_t MmapAllocator<T>::mapping_length(size_t n) const {
+  // deallocate has to compute the same length as allocate, so round up to the
+  // requested page size even if allocate falls back to smaller pages
+  size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  if (m_policy.page_size == PageSize::Huge2M) {
+    page_size = size_t(1) << 21;
+  } else if (m_policy.page_size == PageSize::Huge1G) {
+    page_size = size_t(1) << 30;
+  }
+  size_t length = n * sizeof(T);
+  return (length + page_size - 1) / page_size * page_size;
+}
+
+template <typename T>
+inline T* MmapAllocator<T>::allocate(size_t n) {
+  size_t length = mapping_length(n);
+  int protection = PROT_READ | PROT_WRITE;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+  void* pointer = MAP_FAILED;
+  if (m_policy.page_size == PageSize::Huge2M
+      || m_policy.page_size == PageSize::Huge1G) {
+    int page_shift = m_policy.page_size == PageSize::Huge2M ? 21 : 30;
+    pointer = mmap(nullptr, length, protection,
+                   flags | MAP_HUGETLB | (page_shift << MAP_HUGE_SHIFT), -1, 0);
+  }
+  if (pointer == MAP_FAILED) {
+    pointer = mmap(nullptr, length, protection, flags, -1, 0);
+    if (pointer == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    if (m_policy.page_size != PageSize::Default) {
+      madvise(pointer, length, MADV_HUGEPAGE);
+    }
+  }
+
+  if (m_policy.numa != NumaPlacement::Default) {
+    std::vector<size_t> nodes;
+    for (size_t node = 0; node < 64; node++) {
+      if (m_policy.node_mask >> node & 1) {
+        nodes.push_back(node);
+      }
+    }
+    if (nodes.empty()) {
+      nodes = numa_online_nodes();
+    }
+    // as many words as the highest node needs, machines may have more than 64
+    size_t word_bits = sizeof(unsigned long) * 8;
+    size_t max_node = nodes.empty()
+                        ? 0
+                        : *std::max_element(nodes.begin(), nodes.end());
+    std::vector<unsigned long> node_mask(max_node / word_bits + 1);
+    for (size_t node : nodes) {
+      node_mask[node / word_bits] |= 1ul << node % word_bits;
+    }
+    int mode =
+      m_policy.numa == NumaPlacement::Bind ? MPOL_BIND : MPOL_INTERLEAVE;
+    // the kernel expects the number of mask bits plus one
+    syscall(SYS_mbind, pointer, length, mode, node_mask.data(),
+            node_mask.size() * word_bits + 1, 0);
+  }
+
+  return static_cast<T*>(pointer);
+}
+
+template <typename T>
+inline void MmapAllocator<T>::deallocate(T* pointer, size_t n) {
+  munmap(pointer, mapping_length(n));
+}
+
+// Default allocator of CuckooFilter's storage. Small arrays come zeroed from
+// calloc, large ones from anonymous mappings, which the kernel zeroes lazily
+// on first touch. Either way, construction doesn't write the array, and a
+// 64 GiB filter is created in no time, without faulting in its pages.
+// Value-initialization is a no-op as for MmapAllocator, with the same
+// precondition: containers must not regrow within their capacity.
+template <typename T>
+class LazyZeroAllocator {
+public:
+  using value_type = T;
+  // arrays of at least this many bytes are placed in their own mapping
+  static constexpr size_t mmap_threshold = size_t(1) << 20;
+
+  LazyZeroAllocator() = default;
+  template <typename U>
+  LazyZeroAllocator(const LazyZeroAllocator<U>&) {
+  }
+
+  T* allocate(size_t n);
+  void deallocate(T* pointer, size_t n);
+
+  // fresh memory is zeroed, see above
+  template <typename U>
+  void construct(U*) {
+  }
+  template <typename U, typename... Args>
+  void construct(U* pointer, Args&&... args) {
+    ::new (static_cast<void*>(pointer)) U(std::forward<Args>(args)...);
+  }
+
+  static bool is_mapped(size_t n) {
+    return n * sizeof(T) >= mmap_threshold;
+  }
+};
+
+template <typename T>
+constexpr size_t LazyZeroAllocator<T>::mmap_threshold;
+
+template <typename T>
+inline T* LazyZeroAllocator<T>::allocate(size_t n) {
+  void* pointer;
+  if (is_mapped(n)) {
+    pointer = mmap(nullptr, n * sizeof(T), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pointer == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+  } else {
+    pointer = std::calloc(n, sizeof(T));
+    if (pointer == nullptr && n > 0) {
+      throw std::bad_alloc();
+    }
+  }
+  return static_cast<T*>(pointer);
+}
+
+template <typename T>
+inline void LazyZeroAllocator<T>::deallocate(T* pointer, size_t n) {
+  if (is_mapped(n)) {
+    munmap(pointer, n * sizeof(T));
+  } else {
+    std::free(pointer);
+  }
+}
+
+template <typename T, typename U>
+inline bool operator==(const LazyZeroAllocator<T>&,
+                       const LazyZeroAllocator<U>&) {
+  return true;
+}
+
+template <typename T, typename U>
+inline bool operator!=(const LazyZeroAllocator<T>&,
+                       const LazyZeroAllocator<U>&) {
+  return false;
+}
+
+// Zero n bytes at data, which have been obtained from allocator, e.g. to
+// clear a filter. Overloaded for allocators known to hand out anonymous
+// mappings, for which large arrays are zeroed by discarding their pages.
+template <typename Allocator>
+inline void zero_memory(const Allocator&, uint8_t* data, size_t n) {
+  std::fill(data, data + n, 0);
+}
+
+template <typename T>
+inline void zero_memory(const LazyZeroAllocator<T>&, uint8_t* data,
+                        size_t n) {
+  if (!LazyZeroAllocator<uint8_t>::is_mapped(n) || !discard_pages(data, n)) {
+    std::fill(data, data + n, 0);
+  }
+}
+
+template <typename T>
+inline void zero_memory(const MmapAllocator<T>&, uint8_t* data, size_t n) {
+  if (n < LazyZeroAllocator<uint8_t>::mmap_threshold
+      || !discard_pages(data, n)) {
+    std::fill(data, data + n, 0);
+  }
+}
+
+template <typename T, typename U>
+inline bool operator==(const MmapAllocator<T>& a, const MmapAllocator<U>& b) {
+  return a.policy().page_size == b.policy().page_size
+         && a.policy().numa == b.policy().numa
+         && a.policy().node_mask == b.policy().node_mask;
+}
+
+template <typename T, typename U>
+inline bool operator!=(const MmapAllocator<T>& a, const MmapAllocator<U>& b) {
+  return !(a == b);
+}
+
+} // namespace cuculiform
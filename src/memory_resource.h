@@ -0,0 +1,173 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <stdint.h>
+
+namespace cuculiform {
+
+// Minimal C++11 counterpart of std::pmr::memory_resource, so that the bucket
+// storage of CuckooFilter can be placed in arenas, shared memory segments or
+// pre-faulted pools chosen at runtime. With C++17, std::pmr resources can be
+// used directly through std::pmr::polymorphic_allocator<uint8_t> instead.
+class MemoryResource {
+public:
+  virtual ~MemoryResource() = default;
+
+  void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t)) {
+    return do_allocate(bytes, alignment);
+  }
+  void deallocate(void* pointer, size_t bytes,
+                  size_t alignment = alignof(std::max_align_t)) {
+    do_deallocate(pointer, bytes, alignment);
+  }
+  bool is_equal(const MemoryResource& other) const {
+    return this == &other || do_is_equal(other);
+  }
+
+private:
+  virtual void* do_allocate(size_t bytes, size_t alignment) = 0;
+  virtual void do_deallocate(void* pointer, size_t bytes,
+                             size_t alignment) = 0;
+  virtual bool do_is_equal(const MemoryResource& other) const {
+    return this == &other;
+  }
+};
+
+// MemoryResource forwarding to global operator new and delete
+class NewDeleteResource : public MemoryResource {
+private:
+  void* do_allocate(size_t bytes, size_t) override {
+    return ::operator new(bytes);
+  }
+  void do_deallocate(void* pointer, size_t, size_t) override {
+    ::operator delete(pointer);
+  }
+};
+
+inline MemoryResource* new_delete_resource() {
+  static NewDeleteResource resource;
+  return &resource;
+}
+
+// MemoryResource handing out memory from a caller-provided buffer by bumping
+// a pointer. Deallocation is a no-op, memory is reclaimed all at once by
+// release(). Once the buffer is exhausted, requests go to the upstream
+// resource, which are freed on release() as well.
+// Not thread-safe, like std::pmr::monotonic_buffer_resource.
+class MonotonicBufferResource : public MemoryResource {
+public:
+  explicit MonotonicBufferResource(
+    void* buffer, size_t size,
+    MemoryResource* upstream = new_delete_resource())
+      : m_buffer(static_cast<uint8_t*>(buffer)),
+        m_size(size),
+        m_used(0),
+        m_upstream(upstream),
+        m_upstream_chunks(nullptr) {
+  }
+  MonotonicBufferResource(const MonotonicBufferResource&) = delete;
+  MonotonicBufferResource& operator=(const MonotonicBufferResource&) = delete;
+  ~MonotonicBufferResource() {
+    release();
+  }
+
+  // free everything allocated so far and start over at the buffer's beginning
+  void release();
+
+private:
+  // header of a chunk obtained from upstream, chained for release()
+  struct UpstreamChunk {
+    UpstreamChunk* next;
+    size_t size;
+  };
+
+  uint8_t* m_buffer;
+  size_t m_size;
+  size_t m_used;
+  MemoryResource* m_upstream;
+  UpstreamChunk* m_upstream_chunks;
+
+  void* do_allocate(size_t bytes, size_t alignment) override;
+  void do_deallocate(void*, size_t, size_t) override {
+  }
+};
+
+inline void* MonotonicBufferResource::do_allocate(size_t bytes,
+                                                  size_t alignment) {
+  uintptr_t address = reinterpret_cast<uintptr_t>(m_buffer) + m_used;
+  size_t padding = (alignment - address % alignment) % alignment;
+  if (m_used + padding + bytes <= m_size) {
+    m_used += padding + bytes;
+    return m_buffer + m_used - bytes;
+  }
+
+  // header size is a multiple of max_align_t's alignment, so the payload
+  // behind it is suitably aligned for any alignment up to that
+  size_t header_size = (sizeof(UpstreamChunk) + alignof(std::max_align_t) - 1)
+                       / alignof(std::max_align_t) * alignof(std::max_align_t);
+  if (alignment > alignof(std::max_align_t)) {
+    throw std::bad_alloc();
+  }
+  size_t chunk_size = header_size + bytes;
+  auto chunk =
+    static_cast<UpstreamChunk*>(m_upstream->allocate(chunk_size));
+  chunk->next = m_upstream_chunks;
+  chunk->size = chunk_size;
+  m_upstream_chunks = chunk;
+  return reinterpret_cast<uint8_t*>(chunk) + header_size;
+}
+
+inline void MonotonicBufferResource::release() {
+  while (m_upstream_chunks != nullptr) {
+    UpstreamChunk* next = m_upstream_chunks->next;
+    m_upstream->deallocate(m_upstream_chunks, m_upstream_chunks->size);
+    m_upstream_chunks = next;
+  }
+  m_used = 0;
+}
+
+// Allocator drawing from a MemoryResource, the counterpart of
+// std::pmr::polymorphic_allocator. Use it as the Allocator of a CuckooFilter,
+// e.g. CuckooFilter<uint64_t, ResourceAllocator<uint8_t>>.
+template <typename T>
+class ResourceAllocator {
+public:
+  using value_type = T;
+
+  ResourceAllocator(MemoryResource* resource = new_delete_resource())
+      : m_resource(resource) {
+  }
+  template <typename U>
+  ResourceAllocator(const ResourceAllocator<U>& other)
+      : m_resource(other.resource()) {
+  }
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(m_resource->allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T* pointer, size_t n) {
+    m_resource->deallocate(pointer, n * sizeof(T), alignof(T));
+  }
+
+  MemoryResource* resource() const {
+    return m_resource;
+  }
+
+private:
+  MemoryResource* m_resource;
+};
+
+template <typename T, typename U>
+inline bool operator==(const ResourceAllocator<T>& a,
+                       const ResourceAllocator<U>& b) {
+  return a.resource()->is_equal(*b.resource());
+}
+
+template <typename T, typename U>
+inline bool operator!=(const ResourceAllocator<T>& a,
+                       const ResourceAllocator<U>& b) {
+  return !(a == b);
+}
+
+} // namespace cuculiform
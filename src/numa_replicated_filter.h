@@ -0,0 +1,83 @@
+#pragma once
+
+#include <memory>
+#include <sched.h>
+#include <vector>
+
+#include "cuculiform.h"
+#include "memory.h"
+
+namespace cuculiform {
+
+// NumaReplicatedFilter keeps a full copy of a read-only CuckooFilter on every
+// NUMA node and routes each lookup to the replica on the node of the calling
+// CPU, so lookups never cross the interconnect.
+// Replicas are snapshots: changes to the source filter after construction are
+// not reflected.
+template <typename T>
+class NumaReplicatedFilter {
+public:
+  using Replica = CuckooFilter<T, MmapAllocator<uint8_t>>;
+
+  template <typename Allocator>
+  explicit NumaReplicatedFilter(const CuckooFilter<T, Allocator>& filter,
+                                PageSize page_size = PageSize::Transparent)
+      : m_cpu_replicas(numa_cpu_nodes()) {
+    std::vector<size_t> nodes = numa_online_nodes();
+    std::vector<size_t> node_replicas;
+    for (size_t node : nodes) {
+      // node masks have 64 bits, CPUs of further nodes use the first replica
+      if (node >= 64) {
+        continue;
+      }
+      MemoryPolicy policy(page_size, NumaPlacement::Bind, uint64_t(1) << node);
+      if (node >= node_replicas.size()) {
+        node_replicas.resize(node + 1, 0);
+      }
+      node_replicas[node] = m_replicas.size();
+      m_replicas.emplace_back(
+        new Replica(filter, MmapAllocator<uint8_t>(policy)));
+    }
+    if (m_replicas.empty()) {
+      m_replicas.emplace_back(new Replica(
+        filter, MmapAllocator<uint8_t>(MemoryPolicy(page_size))));
+    }
+    // translate the node of every CPU into the index of its replica
+    for (auto& cpu_replica : m_cpu_replicas) {
+      cpu_replica =
+        cpu_replica < node_replicas.size() ? node_replicas[cpu_replica] : 0;
+    }
+  }
+
+  bool contains(const T item) const;
+  size_t replica_count() const;
+  // replica on the node of the calling CPU
+  const Replica& local_replica() const;
+
+private:
+  std::vector<std::unique_ptr<Replica>> m_replicas;
+  std::vector<size_t> m_cpu_replicas; // replica index of every CPU
+};
+
+template <typename T>
+inline bool NumaReplicatedFilter<T>::contains(const T item) const {
+  return local_replica().contains(item);
+}
+
+template <typename T>
+inline size_t NumaReplicatedFilter<T>::replica_count() const {
+  return m_replicas.size();
+}
+
+template <typename T>
+inline const typename NumaReplicatedFilter<T>::Replica&
+NumaReplicatedFilter<T>::local_replica() const {
+  // sched_getcpu is served from the vDSO or rseq area, no syscall involved
+  int cpu = sched_getcpu();
+  if (cpu < 0 || static_cast<size_t>(cpu) >= m_cpu_replicas.size()) {
+    return *m_replicas.front();
+  }
+  return *m_replicas[m_cpu_replicas[cpu]];
+}
+
+} // namespace cuculiform
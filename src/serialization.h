@@ -0,0 +1,374 @@
+#pragma once
+
+#include <algorithm>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <stdint.h>
+#include <vector>
+
+namespace cuculiform {
+
+// Serialized filters start with a fixed-size header, all fields little
+// endian, followed by the payload in one of two formats:
+//
+// Raw: the bucket array as is, bucket after bucket, slot after slot.
+//
+// Compact: one record per bucket or run of empty buckets. A record starts
+// with the bucket's number of fingerprints c. If c is 0, a LEB128 varint
+// follows with the number of further empty buckets in the run. Otherwise c
+// fingerprints of fingerprint_size bytes follow, sorted ascending, as the
+// order of fingerprints within a bucket carries no information.
+// Empty slots are dropped this way, which pays off below full load. Writers
+// fall back to the raw format if it would be smaller.
+//
+// Delta: changes to a filter with the same geometry, applied on top of it.
+// A record holds a run of consecutive buckets: a varint with the number of
+// unchanged buckets since the end of the previous run, a varint with the
+// number of buckets in the run, then these buckets as in the raw format.
+// The header's size is the filter's size after applying the delta.
+enum class SerializationFormat : uint8_t {
+  Raw = 0,
+  Compact = 1,
+  Delta = 2,
+};
+
+struct FilterHeader {
+  static constexpr uint32_t magic_number = 0x46435543; // "CUCF"
+  static constexpr uint16_t current_version = 1;
+  static constexpr size_t serialized_size = 48;
+
+  uint32_t magic;
+  uint16_t version;
+  SerializationFormat format;
+  uint8_t fingerprint_size;
+  uint64_t bucket_size;
+  uint64_t bucket_count;
+  uint64_t capacity;
+  uint64_t size;         // number of items in the filter
+  uint64_t payload_size; // number of bytes following the header
+};
+
+namespace serialization {
+
+inline void put_le(uint8_t* out, uint64_t value, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) {
+    out[i] = static_cast<uint8_t>(value >> i * 8);
+  }
+}
+
+inline uint64_t get_le(const uint8_t* in, size_t bytes) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    value |= static_cast<uint64_t>(in[i]) << i * 8;
+  }
+  return value;
+}
+
+inline void encode_header(const FilterHeader& header, uint8_t* out) {
+  put_le(out, header.magic, 4);
+  put_le(out + 4, header.version, 2);
+  put_le(out + 6, static_cast<uint8_t>(header.format), 1);
+  put_le(out + 7, header.fingerprint_size, 1);
+  put_le(out + 8, header.bucket_size, 8);
+  put_le(out + 16, header.bucket_count, 8);
+  put_le(out + 24, header.capacity, 8);
+  put_le(out + 32, header.size, 8);
+  put_le(out + 40, header.payload_size, 8);
+}
+
+// Decode and validate a header, throws std::runtime_error if it is malformed
+inline FilterHeader decode_header(const uint8_t* in) {
+  FilterHeader header;
+  header.magic = static_cast<uint32_t>(get_le(in, 4));
+  header.version = static_cast<uint16_t>(get_le(in + 4, 2));
+  header.format = static_cast<SerializationFormat>(get_le(in + 6, 1));
+  header.fingerprint_size = static_cast<uint8_t>(get_le(in + 7, 1));
+  header.bucket_size = get_le(in + 8, 8);
+  header.bucket_count = get_le(in + 16, 8);
+  header.capacity = get_le(in + 24, 8);
+  header.size = get_le(in + 32, 8);
+  header.payload_size = get_le(in + 40, 8);
+
+  if (header.magic != FilterHeader::magic_number) {
+    throw std::runtime_error("not a serialized cuculiform filter");
+  }
+  if (header.version != FilterHeader::current_version) {
+    throw std::runtime_error("unsupported serialization version");
+  }
+  if (header.format != SerializationFormat::Raw
+      && header.format != SerializationFormat::Compact
+      && header.format != SerializationFormat::Delta) {
+    throw std::runtime_error("unknown serialization format");
+  }
+  return header;
+}
+
+inline void write_header(std::ostream& out, const FilterHeader& header) {
+  uint8_t bytes[FilterHeader::serialized_size];
+  encode_header(header, bytes);
+  out.write(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+}
+
+inline FilterHeader read_header(std::istream& in) {
+  uint8_t bytes[FilterHeader::serialized_size];
+  in.read(reinterpret_cast<char*>(bytes), sizeof(bytes));
+  if (!in) {
+    throw std::runtime_error("truncated filter header");
+  }
+  return decode_header(bytes);
+}
+
+// writes value as LEB128 varint to out, returns the end of the varint
+inline uint8_t* put_varint(uint8_t* out, uint64_t value) {
+  while (value >= 0x80) {
+    *out++ = static_cast<uint8_t>(value) | 0x80;
+    value >>= 7;
+  }
+  *out++ = static_cast<uint8_t>(value);
+  return out;
+}
+
+// reads a varint from [in, end), advancing in
+inline uint64_t get_varint(const uint8_t*& in, const uint8_t* end) {
+  uint64_t value = 0;
+  for (size_t shift = 0; shift < 64; shift += 7) {
+    if (in == end) {
+      throw std::runtime_error("truncated varint");
+    }
+    uint8_t byte = *in++;
+    value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+  throw std::runtime_error("malformed varint");
+}
+
+// The codec is instantiated per fingerprint size, so that loading and storing
+// fingerprints compiles down to plain loads and stores. Every record is
+// handed to output(begin, end) on its own, so the encoding can be counted,
+// buffered or streamed without materializing it.
+template <size_t FingerprintSize, typename Output>
+inline void encode_compact(const uint8_t* data, size_t bucket_count,
+                           size_t bucket_size, Output& output) {
+  size_t bucket_bytes = bucket_size * FingerprintSize;
+  uint32_t fingerprints[8];
+  // a bucket's count and fingerprints or an empty run's 0 and varint
+  uint8_t record[1 + 8 * FingerprintSize + 10];
+  size_t empty_run = 0;
+  for (size_t index = 0; index < bucket_count; index++) {
+    const uint8_t* bucket = data + index * bucket_bytes;
+    size_t count = 0;
+    for (size_t slot = 0; slot < bucket_size; slot++) {
+      uint32_t fingerprint = static_cast<uint32_t>(
+        get_le(bucket + slot * FingerprintSize, FingerprintSize));
+      if (fingerprint != 0) {
+        // insertion sort, buckets are tiny
+        size_t position = count++;
+        while (position > 0 && fingerprints[position - 1] > fingerprint) {
+          fingerprints[position] = fingerprints[position - 1];
+          position--;
+        }
+        fingerprints[position] = fingerprint;
+      }
+    }
+
+    if (count == 0) {
+      empty_run++;
+      continue;
+    }
+    if (empty_run > 0) {
+      record[0] = 0;
+      output(record, put_varint(record + 1, empty_run - 1));
+      empty_run = 0;
+    }
+    uint8_t* out = record;
+    *out++ = static_cast<uint8_t>(count);
+    for (size_t i = 0; i < count; i++) {
+      put_le(out, fingerprints[i], FingerprintSize);
+      out += FingerprintSize;
+    }
+    output(record, out);
+  }
+  if (empty_run > 0) {
+    record[0] = 0;
+    output(record, put_varint(record + 1, empty_run - 1));
+  }
+}
+
+// Encode bucket_count buckets from data in the compact format, handing the
+// records to output. Buckets of more than 8 slots aren't supported.
+template <typename Output>
+inline void encode_compact(const uint8_t* data, size_t bucket_count,
+                           size_t bucket_size, size_t fingerprint_size,
+                           Output& output) {
+  if (bucket_size > 8) {
+    throw std::runtime_error("compact format supports up to 8 slots");
+  }
+  switch (fingerprint_size) {
+    case 1:
+      return encode_compact<1>(data, bucket_count, bucket_size, output);
+    case 2:
+      return encode_compact<2>(data, bucket_count, bucket_size, output);
+    case 3:
+      return encode_compact<3>(data, bucket_count, bucket_size, output);
+    default:
+      return encode_compact<4>(data, bucket_count, bucket_size, output);
+  }
+}
+
+// Outputs for encode_compact: counting the bytes, copying them to memory of
+// sufficient size or writing them to a stream through a small buffer
+struct CountingOutput {
+  size_t size = 0;
+
+  void operator()(const uint8_t* begin, const uint8_t* end) {
+    size += end - begin;
+  }
+};
+
+struct MemoryOutput {
+  uint8_t* out;
+
+  void operator()(const uint8_t* begin, const uint8_t* end) {
+    out = std::copy(begin, end, out);
+  }
+};
+
+class StreamOutput {
+public:
+  explicit StreamOutput(std::ostream& out) : m_out(out), m_buffer(1 << 16) {
+  }
+
+  void operator()(const uint8_t* begin, const uint8_t* end) {
+    if (m_used + (end - begin) > m_buffer.size()) {
+      flush();
+    }
+    m_used = std::copy(begin, end, m_buffer.begin() + m_used)
+             - m_buffer.begin();
+  }
+  void flush() {
+    m_out.write(reinterpret_cast<const char*>(m_buffer.data()), m_used);
+    m_used = 0;
+  }
+
+private:
+  std::ostream& m_out;
+  std::vector<uint8_t> m_buffer;
+  size_t m_used = 0;
+};
+
+// Decode the compact format from [in, end) into data, which has to be zeroed.
+// If occupancy is not null, the buckets' occupancy bitmaps are set as well.
+// Returns the number of items decoded.
+inline size_t decode_compact(const uint8_t* in, const uint8_t* end,
+                             uint8_t* data, uint8_t* occupancy,
+                             size_t bucket_count, size_t bucket_size,
+                             size_t fingerprint_size) {
+  size_t items = 0;
+  size_t bucket_bytes = bucket_size * fingerprint_size;
+  size_t index = 0;
+  while (index < bucket_count) {
+    if (in == end) {
+      throw std::runtime_error("truncated filter payload");
+    }
+    size_t count = *in++;
+    if (count == 0) {
+      index += 1 + get_varint(in, end);
+      continue;
+    }
+    size_t length = count * fingerprint_size;
+    if (count > bucket_size || static_cast<size_t>(end - in) < length) {
+      throw std::runtime_error("malformed filter payload");
+    }
+    std::copy(in, in + length, data + index * bucket_bytes);
+    if (occupancy != nullptr) {
+      occupancy[index] = static_cast<uint8_t>((1u << count) - 1);
+    }
+    in += length;
+    items += count;
+    index++;
+  }
+  if (in != end || index != bucket_count) {
+    throw std::runtime_error("malformed filter payload");
+  }
+  return items;
+}
+
+// Rebuild the occupancy bitmaps of bucket_count buckets in data
+template <size_t FingerprintSize>
+inline void rebuild_occupancy(const uint8_t* data, uint8_t* occupancy,
+                              size_t bucket_count, size_t bucket_size) {
+  for (size_t index = 0; index < bucket_count; index++) {
+    const uint8_t* bucket = data + index * bucket_size * FingerprintSize;
+    uint8_t bits = 0;
+    for (size_t slot = 0; slot < bucket_size; slot++) {
+      bool used = get_le(bucket + slot * FingerprintSize, FingerprintSize) != 0;
+      bits |= static_cast<uint8_t>(used << slot);
+    }
+    occupancy[index] = bits;
+  }
+}
+
+inline void rebuild_occupancy(const uint8_t* data, uint8_t* occupancy,
+                              size_t bucket_count, size_t bucket_size,
+                              size_t fingerprint_size) {
+  switch (fingerprint_size) {
+    case 1:
+      return rebuild_occupancy<1>(data, occupancy, bucket_count, bucket_size);
+    case 2:
+      return rebuild_occupancy<2>(data, occupancy, bucket_count, bucket_size);
+    case 3:
+      return rebuild_occupancy<3>(data, occupancy, bucket_count, bucket_size);
+    default:
+      return rebuild_occupancy<4>(data, occupancy, bucket_count, bucket_size);
+  }
+}
+
+// Append a delta record for the count buckets from bucket first of data,
+// skip buckets after the end of the previous record
+inline void append_delta_run(std::vector<uint8_t>& out, const uint8_t* data,
+                             size_t skip, size_t first, size_t count,
+                             size_t bucket_bytes) {
+  uint8_t varints[20];
+  uint8_t* end = put_varint(put_varint(varints, skip), count);
+  out.insert(out.end(), varints, end);
+  out.insert(out.end(), data + first * bucket_bytes,
+             data + (first + count) * bucket_bytes);
+}
+
+// Copy the runs of the delta payload [in, end) into the bucket array data,
+// rebuilding the occupancy bitmaps of the buckets patched if occupancy isn't
+// nullptr, and call patched(first, count) with the buckets of each run once
+// copied. Throws std::runtime_error on malformed input, data may be patched
+// partially then.
+template <typename Patched>
+inline void decode_delta(const uint8_t* in, const uint8_t* end, uint8_t* data,
+                         uint8_t* occupancy, size_t bucket_count,
+                         size_t bucket_size, size_t fingerprint_size,
+                         Patched patched) {
+  size_t bucket_bytes = bucket_size * fingerprint_size;
+  size_t index = 0;
+  while (in != end) {
+    uint64_t skip = get_varint(in, end);
+    uint64_t count = get_varint(in, end);
+    if (skip > bucket_count - index || count > bucket_count - index - skip
+        || count * bucket_bytes > static_cast<size_t>(end - in)) {
+      throw std::runtime_error("malformed filter payload");
+    }
+    index += skip;
+    std::copy(in, in + count * bucket_bytes, data + index * bucket_bytes);
+    if (occupancy != nullptr) {
+      rebuild_occupancy(data + index * bucket_bytes, occupancy + index, count,
+                        bucket_size, fingerprint_size);
+    }
+    patched(index, static_cast<size_t>(count));
+    in += count * bucket_bytes;
+    index += count;
+  }
+}
+
+} // namespace serialization
+
+} // namespace cuculiform
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace cuculiform {
+
+// Counters about the work done by insert, collected by CuckooFilter
+struct Statistics {
+  size_t relocations = 0;       // number of fingerprints kicked out
+  size_t relocated_inserts = 0; // successful inserts that needed relocations
+  size_t failed_inserts = 0;    // inserts that had to throw out a fingerprint
+  size_t cycle_aborts = 0; // failed inserts aborted early because of a cycle
+};
+
+} // namespace cuculiform
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <stdint.h>
+#include <vector>
+
+#include "serialization.h"
+
+namespace cuculiform {
+
+// Workload traces are sequences of (operation, key hash) records, e.g.
+// recorded from a live filter via CuckooFilter::set_recorder and replayed
+// by bench/replay.cc against other configurations. The key hash is the
+// std::hash of the item, which is the identity for integral items, so
+// replaying into a CuckooFilter<uint64_t> reproduces the original buckets.
+//
+// Format: a header of the magic number and version, 4 and 2 bytes, and 2
+// reserved bytes, followed by records of the operation in 1 byte and the key
+// hash in 8 bytes, all little endian.
+enum class TraceOp : uint8_t {
+  Insert = 0,
+  Contains = 1,
+  Erase = 2,
+};
+
+struct TraceRecord {
+  TraceOp op;
+  uint64_t key_hash;
+};
+
+namespace trace {
+
+constexpr uint32_t magic_number = 0x54435543; // "CUCT"
+constexpr uint16_t current_version = 1;
+constexpr size_t header_size = 8;
+constexpr size_t record_size = 9;
+
+} // namespace trace
+
+// Appends records to a stream, buffered. Not thread-safe.
+class TraceWriter {
+public:
+  explicit TraceWriter(std::ostream& out) : m_out(out), m_count(0) {
+    uint8_t header[trace::header_size] = {};
+    serialization::put_le(header, trace::magic_number, 4);
+    serialization::put_le(header + 4, trace::current_version, 2);
+    m_out.write(reinterpret_cast<const char*>(header), sizeof(header));
+    m_buffer.reserve(buffer_size);
+  }
+  TraceWriter(const TraceWriter&) = delete;
+  TraceWriter& operator=(const TraceWriter&) = delete;
+  ~TraceWriter() {
+    flush();
+  }
+
+  void record(TraceOp op, uint64_t key_hash) {
+    uint8_t bytes[trace::record_size];
+    bytes[0] = static_cast<uint8_t>(op);
+    serialization::put_le(bytes + 1, key_hash, 8);
+    m_buffer.insert(m_buffer.end(), bytes, bytes + sizeof(bytes));
+    m_count++;
+    if (m_buffer.size() >= buffer_size) {
+      flush();
+    }
+  }
+  void flush() {
+    m_out.write(reinterpret_cast<const char*>(m_buffer.data()),
+                m_buffer.size());
+    m_out.flush();
+    m_buffer.clear();
+  }
+  // number of records written
+  size_t count() const {
+    return m_count;
+  }
+
+private:
+  static constexpr size_t buffer_size = 1 << 16;
+
+  std::ostream& m_out;
+  std::vector<uint8_t> m_buffer;
+  size_t m_count;
+};
+
+// Read a whole trace, throws std::runtime_error if it is malformed
+inline std::vector<TraceRecord> read_trace(std::istream& in) {
+  using serialization::get_le;
+
+  uint8_t header[trace::header_size];
+  in.read(reinterpret_cast<char*>(header), sizeof(header));
+  if (!in || get_le(header, 4) != trace::magic_number) {
+    throw std::runtime_error("not a cuculiform trace");
+  }
+  if (get_le(header + 4, 2) != trace::current_version) {
+    throw std::runtime_error("unsupported trace version");
+  }
+
+  std::vector<TraceRecord> records;
+  uint8_t bytes[trace::record_size];
+  while (in.read(reinterpret_cast<char*>(bytes), sizeof(bytes))) {
+    if (bytes[0] > static_cast<uint8_t>(TraceOp::Erase)) {
+      throw std::runtime_error("unknown trace operation");
+    }
+    records.push_back(
+      TraceRecord{static_cast<TraceOp>(bytes[0]), get_le(bytes + 1, 8)});
+  }
+  if (in.gcount() != 0) {
+    throw std::runtime_error("truncated trace record");
+  }
+  return records;
+}
+
+} // namespace cuculiform
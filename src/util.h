@@ -99,6 +99,23 @@ class TwoIndependentMultiplyShift {
 public:
   TwoIndependentMultiplyShift() {
     std::random_device random;
+    init(random);
+  }
+  // draw the constants from a seeded generator, for reproducible hashing
+  explicit TwoIndependentMultiplyShift(uint64_t seed) {
+    std::seed_seq sequence{static_cast<uint32_t>(seed),
+                           static_cast<uint32_t>(seed >> 32)};
+    std::mt19937 random(sequence);
+    init(random);
+  }
+
+  uint64_t operator()(uint64_t value) const {
+    return (add + multiply * static_cast<decltype(multiply)>(value)) >> 64;
+  }
+
+private:
+  template <typename Generator>
+  void init(Generator& random) {
     for (auto v : {&multiply, &add}) {
       *v = random();
       for (int i = 0; i < 4; ++i) {
@@ -107,10 +124,6 @@ public:
       }
     }
   }
-
-  uint64_t operator()(uint64_t value) const {
-    return (add + multiply * static_cast<decltype(multiply)>(value)) >> 64;
-  }
 };
 #pragma GCC diagnostic pop
 
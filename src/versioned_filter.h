@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <utility>
+
+#include "cuculiform.h"
+
+namespace cuculiform {
+
+// Publishes an immutable CuckooFilter to concurrent readers and replaces it
+// as a whole, e.g. after rebuilding it with new parameters off to the side.
+// Readers never block or take locks, and see either the old or the new
+// filter. The replaced filter is freed once all readers that may still use
+// it are done. Published filters mustn't record traces, see set_recorder.
+//
+// Reclamation is epoch-based: readers announce themselves in the reader
+// count of the current epoch's parity, striped over cache lines. publish
+// swaps the pointer, advances the epoch and waits for the counts of the
+// previous epoch to drain before freeing the old filter. Readers arriving
+// meanwhile count towards the new epoch and can only see the new filter.
+template <typename T, typename Allocator = LazyZeroAllocator<uint8_t>>
+class VersionedFilter {
+public:
+  using Filter = CuckooFilter<T, Allocator>;
+
+  explicit VersionedFilter(std::unique_ptr<const Filter> filter)
+      : m_current(filter.release()), m_epoch(0) {
+    for (auto& parity : m_readers) {
+      for (auto& readers : parity) {
+        readers.count.store(0, std::memory_order_relaxed);
+      }
+    }
+  }
+  VersionedFilter(const VersionedFilter&) = delete;
+  VersionedFilter& operator=(const VersionedFilter&) = delete;
+  // no readers or writers may be active anymore
+  ~VersionedFilter() {
+    delete m_current.load();
+  }
+
+  bool contains(const T& item) const {
+    return read([&item](const Filter& filter) {
+      return filter.contains(item);
+    });
+  }
+  // Call function with the current filter, which stays valid during the
+  // call even if another one is published meanwhile
+  template <typename Function>
+  auto read(Function function) const
+    -> decltype(function(std::declval<const Filter&>()));
+
+  // Replace the filter, waiting for the readers of the old one before it is
+  // freed. Writers are serialized.
+  void publish(std::unique_ptr<const Filter> filter);
+
+  // number of filters published since construction
+  uint64_t version() const {
+    return m_epoch.load();
+  }
+
+private:
+  static constexpr size_t reader_stripes = 64;
+  struct Readers {
+    std::atomic<uint64_t> count;
+    char padding[64 - sizeof(std::atomic<uint64_t>)];
+  };
+
+  std::atomic<const Filter*> m_current;
+  std::atomic<uint64_t> m_epoch;
+  mutable Readers m_readers[2][reader_stripes];
+  std::mutex m_writer;
+
+  // the stripe of the calling thread, assigned round robin
+  static size_t reader_stripe() {
+    static std::atomic<size_t> next_thread(0);
+    thread_local size_t stripe = next_thread++ % reader_stripes;
+    return stripe;
+  }
+};
+
+// The loads and counts are sequentially consistent: a reader whose count
+// publish doesn't see yet loads the pointer only after publish swapped it,
+// and a reader counted in an epoch is waited for by the publish ending it,
+// which has to finish before the next one can free what the reader loaded.
+template <typename T, typename Allocator>
+template <typename Function>
+inline auto VersionedFilter<T, Allocator>::read(Function function) const
+  -> decltype(function(std::declval<const Filter&>())) {
+  // counts are decremented even if function throws
+  struct Guard {
+    std::atomic<uint64_t>& count;
+    ~Guard() {
+      count.fetch_sub(1);
+    }
+  };
+  // announce in the current epoch, retrying if it advanced meanwhile, as
+  // publish may have stopped waiting for the epoch counted in
+  size_t stripe = reader_stripe();
+  uint64_t epoch = m_epoch.load();
+  for (;;) {
+    m_readers[epoch % 2][stripe].count.fetch_add(1);
+    uint64_t current = m_epoch.load();
+    if (current == epoch) {
+      break;
+    }
+    m_readers[epoch % 2][stripe].count.fetch_sub(1);
+    epoch = current;
+  }
+  Guard guard{m_readers[epoch % 2][stripe].count};
+  return function(*m_current.load());
+}
+
+template <typename T, typename Allocator>
+inline void
+VersionedFilter<T, Allocator>::publish(std::unique_ptr<const Filter> filter) {
+  std::lock_guard<std::mutex> lock(m_writer);
+  const Filter* old = m_current.exchange(filter.release());
+  uint64_t epoch = m_epoch.fetch_add(1);
+  // the grace period: readers of the previous epoch may still use old
+  for (auto& readers : m_readers[epoch % 2]) {
+    while (readers.count.load() != 0) {
+      std::this_thread::yield();
+    }
+  }
+  delete old;
+}
+
+} // namespace cuculiform
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <assert.h>
+#include <functional>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "cuculiform.h"
+
+namespace cuculiform {
+
+// WindowedCuckooFilter answers membership queries over a sliding window of
+// the most recent generation_count generations, e.g. for deduplicating events
+// of the last N minutes with one generation per N / generation_count minutes.
+// Inserts go to the current generation, advance() starts a new one and
+// expires the oldest. Memory is bounded by the window, not the stream.
+//
+// All generations share their geometry and hash functions, so an item's
+// buckets and fingerprint are computed once per operation, and lookups
+// prefetch the item's buckets in every generation before probing them.
+//
+// Expiring a generation only drops it from lookups. Its storage is kept as a
+// spare that the following inserts zero a few buckets at a time, so it is
+// clean by the time it becomes the current generation again; advance()
+// zeroes whatever is left, by discarding pages for large generations.
+template <typename T, typename Allocator = LazyZeroAllocator<uint8_t>>
+class WindowedCuckooFilter {
+public:
+  using Generation = CuckooFilter<T, Allocator>;
+
+  // number of spare buckets zeroed per insert
+  static constexpr size_t clear_step = 8;
+
+  explicit WindowedCuckooFilter(
+    size_t generation_capacity, size_t generation_count,
+    size_t fingerprint_size, uint max_relocations = 500,
+    size_t bucket_size = 4,
+    std::function<uint64_t(size_t)> cuckoo_hash_fn = cuculiform::CityHash{},
+    std::function<uint64_t(size_t)> fingerprint_hash_fn =
+      cuculiform::CityHash{},
+    const Allocator& allocator = Allocator())
+      : m_generation_count(generation_count),
+        m_current(0),
+        m_clear_cursor(0) {
+    assert(m_generation_count > 0);
+    // one more than the window for the spare being cleared
+    for (size_t i = 0; i <= m_generation_count; i++) {
+      m_generations.emplace_back(new Generation(
+        generation_capacity, fingerprint_size, max_relocations, bucket_size,
+        cuckoo_hash_fn, fingerprint_hash_fn, true, allocator));
+    }
+    m_clear_cursor = spare().m_bucket_count;
+  }
+
+  // Insert item into the current generation. Returns false if it is full,
+  // in which case the caller may advance() early.
+  bool insert(const T item);
+  // true if item has been inserted in one of the generations in the window
+  bool contains(const T item) const;
+  // start a new generation, expiring the oldest one
+  void advance();
+  void clear();
+  // number of items in the window
+  size_t size() const;
+  size_t generation_count() const;
+  // generation of the given age, 0 being the current one
+  const Generation& generation(size_t age) const;
+  size_t memory_usage() const;
+
+private:
+  const size_t m_generation_count;
+  // ring of generation_count + 1 generations, the one after the current
+  // generation is the spare
+  std::vector<std::unique_ptr<Generation>> m_generations;
+  size_t m_current;
+  size_t m_clear_cursor; // number of zeroed buckets of the spare
+
+  Generation& spare();
+  // zero up to buckets more buckets of the spare
+  void clear_spare(size_t buckets);
+};
+
+template <typename T, typename Allocator>
+constexpr size_t WindowedCuckooFilter<T, Allocator>::clear_step;
+
+template <typename T, typename Allocator>
+inline bool WindowedCuckooFilter<T, Allocator>::insert(const T item) {
+  clear_spare(clear_step);
+  return m_generations[m_current]->insert(item);
+}
+
+template <typename T, typename Allocator>
+inline bool WindowedCuckooFilter<T, Allocator>::contains(const T item) const {
+  size_t index;
+  size_t alt_index;
+  Fingerprint fingerprint;
+  std::tie(index, alt_index, fingerprint) =
+    m_generations[m_current]->get_indexes_and_fingerprint_for(item);
+
+  size_t ring_size = m_generations.size();
+  for (size_t age = 0; age < m_generation_count; age++) {
+    const Generation& generation =
+      *m_generations[(m_current + ring_size - age) % ring_size];
+    generation.prefetch_bucket(index);
+    generation.prefetch_bucket(alt_index);
+  }
+  // newest first, recent items are the most likely to be queried again
+  for (size_t age = 0; age < m_generation_count; age++) {
+    const Generation& generation =
+      *m_generations[(m_current + ring_size - age) % ring_size];
+    if (generation.contains_fingerprint(index, alt_index, fingerprint)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename T, typename Allocator>
+inline void WindowedCuckooFilter<T, Allocator>::advance() {
+  clear_spare(spare().m_bucket_count);
+  m_current = (m_current + 1) % m_generations.size();
+  // the oldest generation drops out of the window and becomes the spare
+  m_clear_cursor = 0;
+}
+
+template <typename T, typename Allocator>
+inline void WindowedCuckooFilter<T, Allocator>::clear() {
+  for (auto& generation : m_generations) {
+    generation->clear();
+  }
+  m_clear_cursor = spare().m_bucket_count;
+}
+
+template <typename T, typename Allocator>
+inline size_t WindowedCuckooFilter<T, Allocator>::size() const {
+  size_t size = 0;
+  for (size_t age = 0; age < m_generation_count; age++) {
+    size += generation(age).size();
+  }
+  return size;
+}
+
+template <typename T, typename Allocator>
+inline size_t WindowedCuckooFilter<T, Allocator>::generation_count() const {
+  return m_generation_count;
+}
+
+template <typename T, typename Allocator>
+inline const typename WindowedCuckooFilter<T, Allocator>::Generation&
+WindowedCuckooFilter<T, Allocator>::generation(size_t age) const {
+  assert(age < m_generation_count);
+  size_t ring_size = m_generations.size();
+  return *m_generations[(m_current + ring_size - age) % ring_size];
+}
+
+template <typename T, typename Allocator>
+inline size_t WindowedCuckooFilter<T, Allocator>::memory_usage() const {
+  size_t usage = sizeof(WindowedCuckooFilter<T, Allocator>);
+  for (auto& generation : m_generations) {
+    usage += generation->memory_usage();
+  }
+  return usage;
+}
+
+template <typename T, typename Allocator>
+inline typename WindowedCuckooFilter<T, Allocator>::Generation&
+WindowedCuckooFilter<T, Allocator>::spare() {
+  return *m_generations[(m_current + 1) % m_generations.size()];
+}
+
+template <typename T, typename Allocator>
+inline void WindowedCuckooFilter<T, Allocator>::clear_spare(size_t buckets) {
+  Generation& generation = spare();
+  size_t bucket_count = generation.m_bucket_count;
+  if (m_clear_cursor == bucket_count) {
+    return;
+  }
+  if (m_clear_cursor == 0 && buckets >= bucket_count) {
+    generation.clear();
+    m_clear_cursor = bucket_count;
+    return;
+  }
+
+  size_t end = std::min(bucket_count, m_clear_cursor + buckets);
+  size_t bucket_bytes =
+    generation.m_bucket_size * generation.m_fingerprint_size;
+  zero_memory(generation.m_data.get_allocator(),
+              generation.m_data.data() + m_clear_cursor * bucket_bytes,
+              (end - m_clear_cursor) * bucket_bytes);
+  // not tracked for buckets too large for the bitmap
+  if (!generation.m_occupancy.empty()) {
+    zero_memory(generation.m_occupancy.get_allocator(),
+                generation.m_occupancy.data() + m_clear_cursor,
+                end - m_clear_cursor);
+  }
+  m_clear_cursor = end;
+  if (m_clear_cursor == bucket_count) {
+    generation.m_pending.clear();
+    generation.m_size = 0;
+  }
+}
+
+} // namespace cuculiform
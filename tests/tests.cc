@@ -1,6 +1,15 @@
 #define CATCH_CONFIG_MAIN
 #include "catch/catch.hpp"
+#include "adaptive_cuckoo_filter.h"
+#include "concurrent_cuckoo_filter.h"
+#include "cuckoo_filter_view.h"
+#include "cuckoo_hash_map.h"
 #include "cuculiform.h"
+#include "expiring_cuckoo_filter.h"
+#include "memory_resource.h"
+#include "numa_replicated_filter.h"
+#include "versioned_filter.h"
+#include "windowed_cuckoo_filter.h"
 
 #include <functional>
 #include <string>
@@ -11,6 +20,9 @@
 #include <chrono>
 #include <ctime>
 #include <random>
+#include <sstream>
+#include <sys/wait.h>
+#include <thread>
 #include <unordered_set>
 
 TEST_CASE("create cuckoofilter", "[cuculiform]") {
@@ -240,3 +252,1129 @@ TEST_CASE("intelligence data test", "[cuculiform]") {
   // 10k runs: false positive ratio average: 0,00300382 σ: 0,00469904 (156,4%) max: 0,1825 min: 0,0003
   REQUIRE(mean < 0.0040);
 }
+
+TEST_CASE("adaptive cuckoofilter", "[cuculiform][adaptive]") {
+  size_t capacity = 1 << 12;
+  size_t fingerprint_size = 1;
+  cuculiform::AdaptiveCuckooFilter<uint64_t> filter{capacity,
+                                                    fingerprint_size};
+
+  size_t to_insert = capacity * 9 / 10;
+  for (size_t i = 0; i < to_insert; i++) {
+    REQUIRE(filter.insert(i) == true);
+  }
+  REQUIRE(filter.size() == to_insert);
+
+  // collect false positives and report them back to the filter
+  std::vector<uint64_t> false_positives;
+  for (size_t i = capacity; i < 2 * capacity; i++) {
+    if (filter.contains(i)) {
+      false_positives.push_back(i);
+    }
+  }
+  REQUIRE(false_positives.size() > 0);
+  for (auto item : false_positives) {
+    // the new fingerprint of an adapted slot may collide again by chance
+    for (int attempt = 0; attempt < 8 && filter.contains(item); attempt++) {
+      REQUIRE(filter.adapt(item) == true);
+    }
+    REQUIRE(filter.contains(item) == false);
+  }
+
+  // adapting must never introduce false negatives
+  for (size_t i = 0; i < to_insert; i++) {
+    REQUIRE(filter.contains(i) == true);
+  }
+  // adapting a member only touches other items' colliding slots
+  filter.adapt(0);
+  REQUIRE(filter.contains(0) == true);
+
+  REQUIRE(filter.erase(0) == true);
+  REQUIRE(filter.erase(0) == false);
+  REQUIRE(filter.size() == to_insert - 1);
+}
+
+TEST_CASE("occupancy tracking", "[cuculiform][occupancy]") {
+  size_t capacity = 1 << 12;
+  size_t fingerprint_size = 2;
+  cuculiform::CuckooFilter<uint64_t> tracked{
+    capacity, fingerprint_size, 500, 4, cuculiform::CityHash{},
+    cuculiform::CityHash{}, true};
+  cuculiform::CuckooFilter<uint64_t> untracked{
+    capacity, fingerprint_size, 500, 4, cuculiform::CityHash{},
+    cuculiform::CityHash{}, false};
+  REQUIRE(tracked.memory_usage() > untracked.memory_usage());
+
+  size_t to_insert = capacity * 9 / 10;
+  for (size_t i = 0; i < to_insert; i++) {
+    REQUIRE(tracked.insert(i) == true);
+    REQUIRE(untracked.insert(i) == true);
+  }
+  // erase every other element so that buckets get holes in the middle
+  for (size_t i = 0; i < to_insert; i += 2) {
+    REQUIRE(tracked.erase(i) == true);
+    REQUIRE(untracked.erase(i) == true);
+  }
+  for (size_t i = 0; i < to_insert; i += 2) {
+    REQUIRE(tracked.insert(i) == true);
+    REQUIRE(untracked.insert(i) == true);
+  }
+  for (size_t i = 0; i < to_insert; i++) {
+    REQUIRE(tracked.contains(i) == true);
+    REQUIRE(untracked.contains(i) == true);
+  }
+  REQUIRE(tracked.load_factor() == Approx(0.9).epsilon(0.01));
+  REQUIRE(tracked.load_factor() == untracked.load_factor());
+
+  tracked.clear();
+  REQUIRE(tracked.load_factor() == 0);
+  REQUIRE(tracked.contains(1) == false);
+  REQUIRE(tracked.insert(1) == true);
+  REQUIRE(tracked.contains(1) == true);
+
+  // buckets too large for the bitmaps fill up as without tracking
+  cuculiform::CuckooFilter<uint64_t> large{capacity, fingerprint_size, 500,
+                                           16};
+  REQUIRE(large.memory_usage() == untracked.memory_usage());
+  for (size_t i = 0; i < to_insert; i++) {
+    REQUIRE(large.insert(i) == true);
+  }
+  for (size_t i = 0; i < to_insert; i++) {
+    REQUIRE(large.contains(i) == true);
+  }
+  REQUIRE(large.size() == to_insert);
+}
+
+TEST_CASE("relocation cycle detection", "[cuculiform][statistics]") {
+  // two buckets only, so every relocation chain is trapped in them
+  size_t capacity = 8;
+  size_t fingerprint_size = 2;
+  uint max_relocations = 500;
+  cuculiform::CuckooFilter<uint64_t> filter{capacity, fingerprint_size,
+                                            max_relocations};
+
+  size_t i = 0;
+  while (filter.insert(i)) {
+    i++;
+  }
+  REQUIRE(i <= capacity);
+
+  auto& statistics = filter.statistics();
+  REQUIRE(statistics.failed_inserts == 1);
+  REQUIRE(statistics.cycle_aborts == 1);
+  REQUIRE(statistics.relocations < max_relocations / 10);
+}
+
+TEST_CASE("de-amortized insertion", "[cuculiform][deamortized]") {
+  size_t capacity = 1 << 12;
+  size_t fingerprint_size = 2;
+  uint max_relocations = 500;
+  cuculiform::CuckooFilter<uint64_t> filter{capacity, fingerprint_size,
+                                            max_relocations};
+  size_t kicks_per_operation = 2;
+  size_t pending_capacity = 8;
+  filter.set_deamortized(kicks_per_operation, pending_capacity);
+
+  size_t inserted = 0;
+  size_t to_insert = capacity * 19 / 20;
+  for (size_t i = 0; i < to_insert; i++) {
+    size_t relocations = filter.statistics().relocations;
+    if (filter.insert(i)) {
+      inserted++;
+    }
+    // hard bound on the work done by a single operation
+    REQUIRE(filter.statistics().relocations - relocations
+            <= kicks_per_operation);
+    REQUIRE(filter.pending() <= pending_capacity);
+  }
+  REQUIRE(filter.statistics().relocations > 0);
+  REQUIRE(filter.size() == inserted);
+
+  // pending fingerprints are visible to contains
+  size_t contained = 0;
+  for (size_t i = 0; i < to_insert; i++) {
+    contained += filter.contains(i);
+  }
+  REQUIRE(contained >= inserted);
+
+  filter.relocate_pending(pending_capacity);
+  // switching back drains the queue completely, whatever is left in it
+  filter.set_deamortized(0);
+  REQUIRE(filter.pending() == 0);
+  REQUIRE(filter.size() + filter.statistics().failed_inserts == to_insert);
+
+  bool contains_zero = filter.contains(0);
+  REQUIRE(filter.erase(0) == contains_zero);
+}
+
+TEST_CASE("erase by slot handle", "[cuculiform][handle]") {
+  size_t capacity = 1 << 12;
+  size_t fingerprint_size = 2;
+  cuculiform::CuckooFilter<uint64_t> filter{capacity, fingerprint_size};
+
+  // fill up far enough that later inserts relocate earlier fingerprints
+  size_t to_insert = capacity * 19 / 20;
+  std::vector<cuculiform::SlotHandle> handles(to_insert);
+  for (size_t i = 0; i < to_insert; i++) {
+    REQUIRE(filter.insert(i, handles[i]) == true);
+  }
+  REQUIRE(filter.statistics().relocations > 0);
+
+  for (size_t i = 0; i < to_insert; i++) {
+    REQUIRE(filter.erase(handles[i]) == true);
+  }
+  REQUIRE(filter.size() == 0);
+  REQUIRE(filter.load_factor() == 0);
+
+  cuculiform::SlotHandle handle;
+  REQUIRE(filter.insert(42, handle) == true);
+  REQUIRE(handle.slot != cuculiform::SlotHandle::unknown_slot);
+  REQUIRE(filter.contains(42) == true);
+  REQUIRE(filter.erase(handle) == true);
+  REQUIRE(filter.contains(42) == false);
+  REQUIRE(filter.erase(handle) == false);
+}
+
+TEST_CASE("huge page and numa placement", "[cuculiform][memory]") {
+  size_t capacity = 1 << 16;
+  size_t fingerprint_size = 2;
+  using Allocator = cuculiform::MmapAllocator<uint8_t>;
+  cuculiform::MemoryPolicy policy(cuculiform::PageSize::Huge2M,
+                                  cuculiform::NumaPlacement::Interleave);
+  cuculiform::CuckooFilter<uint64_t, Allocator> filter{
+    capacity,
+    fingerprint_size,
+    500,
+    4,
+    cuculiform::CityHash{},
+    cuculiform::CityHash{},
+    true,
+    Allocator(policy)};
+
+  size_t to_insert = capacity / 2;
+  for (size_t i = 0; i < to_insert; i++) {
+    REQUIRE(filter.insert(i) == true);
+  }
+
+  cuculiform::NumaReplicatedFilter<uint64_t> replicated{filter};
+  REQUIRE(replicated.replica_count() >= 1);
+  REQUIRE(replicated.local_replica().size() == to_insert);
+  for (size_t i = 0; i < to_insert; i++) {
+    REQUIRE(replicated.contains(i) == true);
+  }
+  for (size_t i = capacity; i < capacity + to_insert; i++) {
+    REQUIRE(replicated.contains(i) == filter.contains(i));
+  }
+}
+
+TEST_CASE("filter in a monotonic arena", "[cuculiform][memory]") {
+  size_t capacity = 1024;
+  size_t fingerprint_size = 2;
+  using Allocator = cuculiform::ResourceAllocator<uint8_t>;
+  // counts the allocations it forwards
+  struct CountingResource : cuculiform::MemoryResource {
+    explicit CountingResource(cuculiform::MemoryResource* target)
+        : target(target), allocations(0) {
+    }
+    cuculiform::MemoryResource* target;
+    size_t allocations;
+
+    void* do_allocate(size_t bytes, size_t alignment) override {
+      allocations++;
+      return target->allocate(bytes, alignment);
+    }
+    void do_deallocate(void* pointer, size_t bytes,
+                       size_t alignment) override {
+      target->deallocate(pointer, bytes, alignment);
+    }
+  };
+
+  // room for the bucket array and the occupancy bitmap
+  std::vector<uint8_t> buffer(capacity * fingerprint_size + capacity);
+  CountingResource upstream(cuculiform::new_delete_resource());
+  cuculiform::MonotonicBufferResource arena(buffer.data(), buffer.size(),
+                                            &upstream);
+  CountingResource served(&arena);
+  for (size_t cycle = 0; cycle < 4; cycle++) {
+    {
+      cuculiform::CuckooFilter<uint64_t, Allocator> filter{
+        capacity,
+        fingerprint_size,
+        500,
+        4,
+        cuculiform::CityHash{},
+        cuculiform::CityHash{},
+        true,
+        Allocator(&served)};
+      for (size_t i = 0; i < capacity / 2; i++) {
+        REQUIRE(filter.insert(i) == true);
+      }
+      for (size_t i = 0; i < capacity / 2; i++) {
+        REQUIRE(filter.contains(i) == true);
+      }
+    }
+    arena.release();
+  }
+  // the bucket array and the bitmap, all from the buffer
+  REQUIRE(served.allocations == 4 * 2);
+  REQUIRE(upstream.allocations == 0);
+}
+
+TEST_CASE("lazily zeroed storage", "[cuculiform][memory]") {
+  // large enough for the bucket array to be placed in its own mapping
+  size_t capacity = 1 << 20;
+  size_t fingerprint_size = 2;
+  REQUIRE(cuculiform::LazyZeroAllocator<uint8_t>::is_mapped(
+    capacity * fingerprint_size));
+  cuculiform::CuckooFilter<uint64_t> filter{capacity, fingerprint_size};
+
+  for (int round = 0; round < 2; round++) {
+    REQUIRE(filter.size() == 0);
+    for (size_t i = 0; i < capacity; i += 64) {
+      REQUIRE(filter.contains(i) == false);
+      REQUIRE(filter.insert(i) == true);
+      REQUIRE(filter.contains(i) == true);
+    }
+    filter.clear();
+  }
+}
+
+TEST_CASE("serialization", "[cuculiform][serialization]") {
+  size_t capacity = 1 << 14;
+  size_t fingerprint_size = 2;
+
+  for (size_t to_insert : {size_t(0), capacity / 8, capacity * 19 / 20}) {
+    cuculiform::CuckooFilter<uint64_t> filter{capacity, fingerprint_size};
+    for (size_t i = 0; i < to_insert; i++) {
+      REQUIRE(filter.insert(i) == true);
+    }
+
+    for (bool compact : {false, true}) {
+      std::stringstream stream;
+      filter.serialize(stream, compact);
+      size_t serialized_size = stream.str().size();
+      if (compact && to_insert < capacity / 2) {
+        REQUIRE(serialized_size < capacity * fingerprint_size / 2);
+      } else {
+        REQUIRE(serialized_size <= capacity * fingerprint_size + 48);
+      }
+
+      cuculiform::CuckooFilter<uint64_t> copy{capacity, fingerprint_size};
+      REQUIRE(copy.insert(capacity) == true);
+      copy.deserialize(stream);
+      REQUIRE(copy.size() == filter.size());
+      REQUIRE(copy.load_factor() == filter.load_factor());
+      for (size_t i = 0; i < 2 * capacity; i++) {
+        REQUIRE(copy.contains(i) == filter.contains(i));
+      }
+      // occupancy is restored as well
+      for (size_t i = 0; i < to_insert; i++) {
+        REQUIRE(copy.erase(i) == true);
+      }
+      REQUIRE(copy.size() == 0);
+    }
+  }
+
+  cuculiform::CuckooFilter<uint64_t> filter{capacity, fingerprint_size};
+  for (size_t i = 0; i < capacity / 4; i++) {
+    REQUIRE(filter.insert(i) == true);
+  }
+  std::vector<uint8_t> buffer;
+  filter.serialize(buffer);
+  cuculiform::CuckooFilter<uint64_t> copy{capacity, fingerprint_size};
+  copy.deserialize(buffer.data(), buffer.size());
+  REQUIRE(copy.size() == filter.size());
+  for (size_t i = 0; i < capacity / 4; i++) {
+    REQUIRE(copy.contains(i) == true);
+  }
+  REQUIRE_THROWS_AS(copy.deserialize(buffer.data(), buffer.size() - 1),
+                    const std::runtime_error&);
+
+  std::stringstream stream;
+  filter.serialize(stream);
+  cuculiform::CuckooFilter<uint64_t> other{2 * capacity, fingerprint_size};
+  REQUIRE_THROWS_AS(other.deserialize(stream), const std::runtime_error&);
+
+  std::stringstream garbage("definitely not a cuckoo filter, but long enough");
+  REQUIRE_THROWS_AS(filter.deserialize(garbage), const std::runtime_error&);
+
+  // streamed and buffered encodings are the same
+  std::stringstream streamed;
+  filter.serialize(streamed);
+  REQUIRE(streamed.str() == std::string(buffer.begin(), buffer.end()));
+
+  // a size beyond the slot count is rejected
+  std::vector<uint8_t> oversized;
+  filter.serialize(oversized, false);
+  cuculiform::serialization::put_le(oversized.data() + 32, capacity * 2, 8);
+  REQUIRE_THROWS_AS(copy.deserialize(oversized.data(), oversized.size()),
+                    const std::runtime_error&);
+
+  // buckets too large for the compact format are written raw
+  cuculiform::CuckooFilter<uint64_t> large{capacity, fingerprint_size, 500,
+                                           16};
+  large.insert(1);
+  std::vector<uint8_t> raw;
+  large.serialize(raw);
+  REQUIRE(cuculiform::serialization::decode_header(raw.data()).format
+          == cuculiform::SerializationFormat::Raw);
+  cuculiform::CuckooFilter<uint64_t> large_copy{capacity, fingerprint_size,
+                                                500, 16};
+  large_copy.deserialize(raw.data(), raw.size());
+  REQUIRE(large_copy.contains(1));
+
+  // a compact payload cut off in a varint leaves the filter empty, not with
+  // the buckets decoded before
+  cuculiform::CuckooFilter<uint64_t> empty{capacity, fingerprint_size};
+  std::vector<uint8_t> cut;
+  empty.serialize(cut, false);
+  cuculiform::FilterHeader header =
+    cuculiform::serialization::decode_header(cut.data());
+  header.format = cuculiform::SerializationFormat::Compact;
+  header.size = 1;
+  // bucket 0 holds fingerprint 1, then a skip record whose varint is cut off
+  std::vector<uint8_t> payload = {1, 1, 0, 0, 0x80};
+  header.payload_size = payload.size();
+  cut.resize(cuculiform::FilterHeader::serialized_size);
+  cuculiform::serialization::encode_header(header, cut.data());
+  cut.insert(cut.end(), payload.begin(), payload.end());
+  cuculiform::CuckooFilter<uint64_t> partial{capacity, fingerprint_size};
+  REQUIRE_THROWS_AS(partial.deserialize(cut.data(), cut.size()),
+                    const std::runtime_error&);
+  REQUIRE(partial.size() == 0);
+  std::vector<uint8_t> partial_bytes;
+  std::vector<uint8_t> empty_bytes;
+  partial.serialize(partial_bytes, false);
+  empty.serialize(empty_bytes, false);
+  REQUIRE(partial_bytes == empty_bytes);
+}
+
+TEST_CASE("sliding window", "[cuculiform][windowed]") {
+  size_t generation_capacity = 1 << 12;
+  size_t generation_count = 3;
+  size_t per_generation = generation_capacity / 2;
+  cuculiform::WindowedCuckooFilter<uint64_t> filter{
+    generation_capacity, generation_count, 2};
+  REQUIRE(filter.generation_count() == generation_count);
+
+  // generation g holds the items [g * per_generation, (g + 1) * per_generation)
+  size_t generations = 8;
+  for (size_t g = 0; g < generations; g++) {
+    if (g > 0) {
+      filter.advance();
+    }
+    for (size_t i = g * per_generation; i < (g + 1) * per_generation; i++) {
+      REQUIRE(filter.insert(i) == true);
+    }
+    REQUIRE(filter.generation(0).size() == per_generation);
+    REQUIRE(filter.size()
+            == std::min(g + 1, generation_count) * per_generation);
+
+    size_t expired = g + 1 > generation_count ? g + 1 - generation_count : 0;
+    for (size_t i = expired * per_generation; i < (g + 1) * per_generation;
+         i++) {
+      REQUIRE(filter.contains(i) == true);
+    }
+    // expired items are only found as false positives
+    size_t false_positives = 0;
+    for (size_t i = 0; i < expired * per_generation; i++) {
+      false_positives += filter.contains(i);
+    }
+    REQUIRE(false_positives <= expired * per_generation / 100 + 1);
+  }
+
+  // advancing through a whole window without inserts empties it
+  for (size_t g = 0; g < generation_count; g++) {
+    filter.advance();
+  }
+  REQUIRE(filter.size() == 0);
+  for (size_t i = 0; i < generations * per_generation; i++) {
+    REQUIRE(filter.contains(i) == false);
+  }
+
+  REQUIRE(filter.insert(1) == true);
+  filter.clear();
+  REQUIRE(filter.size() == 0);
+  REQUIRE(filter.contains(1) == false);
+
+  // buckets too large for occupancy bitmaps are cleared incrementally alike
+  cuculiform::WindowedCuckooFilter<uint64_t> wide{
+    generation_capacity, generation_count, 2, 500, 16};
+  for (size_t g = 0; g < generations; g++) {
+    if (g > 0) {
+      wide.advance();
+    }
+    for (size_t i = g * per_generation; i < (g + 1) * per_generation; i++) {
+      REQUIRE(wide.insert(i) == true);
+    }
+    size_t expired = g + 1 > generation_count ? g + 1 - generation_count : 0;
+    REQUIRE(wide.size() == (g + 1 - expired) * per_generation);
+    for (size_t i = expired * per_generation; i < (g + 1) * per_generation;
+         i++) {
+      REQUIRE(wide.contains(i) == true);
+    }
+  }
+}
+
+TEST_CASE("per-entry expiry", "[cuculiform][expiring]") {
+  size_t capacity = 1 << 14;
+  size_t ttl = 3;
+  size_t per_epoch = capacity / 8;
+  cuculiform::ExpiringCuckooFilter<uint64_t> filter{capacity, 2, ttl};
+  REQUIRE(filter.ttl() == ttl);
+
+  // run past the wraparound of the 4 bit epoch counter, epoch e holds the
+  // items [e * per_epoch, (e + 1) * per_epoch)
+  size_t epochs = 40;
+  for (size_t e = 0; e < epochs; e++) {
+    if (e > 0) {
+      filter.advance_epoch();
+    }
+    REQUIRE(filter.epoch() == e);
+    for (size_t i = e * per_epoch; i < (e + 1) * per_epoch; i++) {
+      REQUIRE(filter.insert(i) == true);
+    }
+    // constant memory: at most ttl epochs plus the one being swept
+    REQUIRE(filter.size() <= (ttl + 1) * per_epoch);
+
+    size_t first_live = e + 1 > ttl ? e + 1 - ttl : 0;
+    for (size_t i = first_live * per_epoch; i < (e + 1) * per_epoch; i++) {
+      REQUIRE(filter.contains(i) == true);
+    }
+    // 12 bit fingerprints, 8 slots probed
+    size_t false_positives = 0;
+    for (size_t i = 0; i < first_live * per_epoch; i++) {
+      false_positives += filter.contains(i);
+    }
+    REQUIRE(false_positives <= first_live * per_epoch / 200 + 1);
+  }
+
+  // re-inserting extends an item's lifetime
+  size_t item = (epochs - 1) * per_epoch;
+  filter.advance_epoch();
+  REQUIRE(filter.insert(item) == true);
+  for (size_t e = 1; e < ttl; e++) {
+    filter.advance_epoch();
+  }
+  REQUIRE(filter.contains(item) == true);
+  REQUIRE(filter.contains(item + 1) == false);
+  REQUIRE(filter.erase(item) == true);
+  REQUIRE(filter.contains(item) == false);
+
+  // a full pass reclaims everything once it has expired
+  for (size_t e = 0; e < ttl; e++) {
+    filter.advance_epoch();
+  }
+  filter.advance_epoch();
+  REQUIRE(filter.size() == 0);
+
+  // items sharing fingerprint and buckets have entries of their own
+  auto constant = [](size_t) { return uint64_t(0x1234567890ABCDEF); };
+  cuculiform::ExpiringCuckooFilter<uint64_t> colliding{
+    1 << 8, 2, ttl, 4, 500, 4, constant, constant};
+  REQUIRE(colliding.insert(1) == true);
+  REQUIRE(colliding.insert(2) == true);
+  REQUIRE(colliding.size() == 2);
+  REQUIRE(colliding.erase(1) == true);
+  REQUIRE(colliding.contains(2) == true);
+}
+
+TEST_CASE("deterministic builds", "[cuculiform][deterministic]") {
+  size_t capacity = 1 << 14;
+  std::vector<uint64_t> keys;
+  for (uint64_t i = 0; i < capacity * 19 / 20; i++) {
+    keys.push_back(i * 0x9E3779B97F4A7C15ull);
+  }
+
+  REQUIRE(cuculiform::TwoIndependentMultiplyShift(42)(7)
+          == cuculiform::TwoIndependentMultiplyShift(42)(7));
+  REQUIRE(cuculiform::TwoIndependentMultiplyShift(42)(7)
+          != cuculiform::TwoIndependentMultiplyShift(43)(7));
+
+  // builds from the same key set in different orders
+  auto build = [&](uint64_t seed) {
+    cuculiform::CuckooFilter<uint64_t> filter{
+      capacity,
+      2,
+      500,
+      4,
+      cuculiform::CityHash(1),
+      cuculiform::CityHash(2)};
+    filter.set_seed(seed);
+    REQUIRE(filter.insert_bulk(keys.begin(), keys.end()) == keys.size());
+    for (auto key : keys) {
+      REQUIRE(filter.contains(key) == true);
+    }
+    std::vector<uint8_t> bytes;
+    filter.serialize(bytes, false);
+    return bytes;
+  };
+  std::vector<uint8_t> first = build(1);
+  std::mt19937 gen(5);
+  std::shuffle(keys.begin(), keys.end(), gen);
+  REQUIRE(build(1) == first);
+  std::reverse(keys.begin(), keys.end());
+  REQUIRE(build(1) == first);
+}
+
+TEST_CASE("cuckoo hash map", "[cuculiform][hash_map]") {
+  size_t capacity = 1 << 14;
+  cuculiform::CuckooHashMap<uint64_t, std::string> map{capacity};
+
+  // fill until the first failed insert
+  uint64_t inserted = 0;
+  while (map.insert(inserted, std::to_string(inserted))) {
+    inserted++;
+  }
+  REQUIRE(map.statistics().failed_inserts == 1);
+  REQUIRE(map.load_factor() > 0.9);
+  REQUIRE(map.size() == inserted);
+  // a failed insert leaves the map unchanged, no key is lost
+  REQUIRE(map.contains(inserted) == false);
+  for (uint64_t key = 0; key < inserted; key++) {
+    REQUIRE(map.find(key) != nullptr);
+    REQUIRE(*map.find(key) == std::to_string(key));
+  }
+  // exact, unlike the filter
+  for (uint64_t key = inserted + 1; key < 2 * capacity; key++) {
+    REQUIRE(map.contains(key) == false);
+  }
+
+  REQUIRE(map.insert(0, "zero") == true);
+  REQUIRE(*map.find(0) == "zero");
+  REQUIRE(map.size() == inserted);
+
+  std::vector<uint64_t> keys;
+  for (uint64_t key = 0; key < 2 * capacity; key += 3) {
+    keys.push_back(key);
+  }
+  std::vector<const std::string*> results(keys.size());
+  size_t found = map.find(keys.data(), keys.size(), results.data());
+  REQUIRE(found == (inserted + 2) / 3);
+  for (size_t i = 0; i < keys.size(); i++) {
+    REQUIRE(results[i] == map.find(keys[i]));
+  }
+
+  for (uint64_t key = 0; key < inserted; key += 2) {
+    REQUIRE(map.erase(key) == true);
+  }
+  REQUIRE(map.erase(0) == false);
+  for (uint64_t key = 0; key < inserted; key++) {
+    REQUIRE(map.contains(key) == (key % 2 == 1));
+  }
+
+  cuculiform::CuckooHashSet<uint64_t> set{capacity};
+  for (uint64_t key = 0; key < capacity / 2; key++) {
+    REQUIRE(set.insert(key) == true);
+  }
+  REQUIRE(set.insert(0) == true);
+  REQUIRE(set.size() == capacity / 2);
+  bool contained[3];
+  uint64_t probes[3] = {0, capacity / 2 - 1, capacity / 2};
+  REQUIRE(set.contains(probes, 3, contained) == 2);
+  REQUIRE(contained[0] == true);
+  REQUIRE(contained[1] == true);
+  REQUIRE(contained[2] == false);
+
+  // keys sharing a tag still spread over all bucket pairs
+  cuculiform::CuckooHashMap<uint64_t, uint64_t> one_tag{
+    capacity, 500, 4, cuculiform::CityHash{}, [](size_t hash) {
+      return uint64_t(1) << 56 | (hash * 0x9E3779B97F4A7C15ull) >> 8;
+    }};
+  uint64_t one_tag_inserted = 0;
+  while (one_tag.insert(one_tag_inserted, one_tag_inserted)) {
+    one_tag_inserted++;
+  }
+  REQUIRE(one_tag.load_factor() > 0.9);
+
+  REQUIRE_THROWS_AS((cuculiform::CuckooHashMap<uint64_t, uint64_t>{
+                      capacity, 500, 16}),
+                    const std::invalid_argument&);
+}
+
+TEST_CASE("trace record and replay", "[cuculiform][trace]") {
+  cuculiform::CuckooFilter<uint64_t> filter{1 << 10, 2};
+  std::stringstream stream;
+  {
+    cuculiform::TraceWriter writer(stream);
+    filter.insert(1);
+    filter.set_recorder(&writer);
+    filter.insert(2);
+    filter.contains(3);
+    filter.erase(2);
+    std::vector<uint64_t> items{4, 5};
+    filter.insert_bulk(items.begin(), items.end());
+    filter.set_recorder(nullptr);
+    filter.insert(6);
+    REQUIRE(writer.count() == 5);
+  }
+
+  std::vector<cuculiform::TraceRecord> records =
+    cuculiform::read_trace(stream);
+  REQUIRE(records.size() == 5);
+  REQUIRE(records[0].op == cuculiform::TraceOp::Insert);
+  REQUIRE(records[0].key_hash == 2);
+  REQUIRE(records[1].op == cuculiform::TraceOp::Contains);
+  REQUIRE(records[1].key_hash == 3);
+  REQUIRE(records[2].op == cuculiform::TraceOp::Erase);
+  REQUIRE(records[2].key_hash == 2);
+  REQUIRE(records[3].key_hash == 4);
+  REQUIRE(records[4].key_hash == 5);
+
+  std::string bytes = stream.str();
+  std::stringstream truncated(bytes.substr(0, bytes.size() - 1));
+  REQUIRE_THROWS_AS(cuculiform::read_trace(truncated),
+                    const std::runtime_error&);
+}
+
+TEST_CASE("latency histograms", "[cuculiform][latency]") {
+  using cuculiform::LatencyHistogram;
+  // bucket bounds are within 1/32 of every value they hold
+  for (uint64_t value : {0, 1, 63, 64, 65, 1000, 123456789}) {
+    uint64_t lower =
+      LatencyHistogram::value_of(LatencyHistogram::index_of(value));
+    REQUIRE(lower <= value);
+    REQUIRE(value - lower <= value / 32);
+  }
+  for (size_t i = 0; i + 1 < LatencyHistogram::bucket_count; i++) {
+    REQUIRE(LatencyHistogram::index_of(LatencyHistogram::value_of(i)) == i);
+  }
+
+  LatencyHistogram first;
+  LatencyHistogram second;
+  for (uint64_t value = 1; value <= 1000; value++) {
+    (value % 2 == 0 ? first : second).record(value);
+  }
+  first.merge(second);
+  REQUIRE(first.count() == 1000);
+  REQUIRE(first.max() == 1000);
+  REQUIRE(first.mean() == Approx(500.5));
+  REQUIRE(first.percentile(50) >= 500);
+  REQUIRE(first.percentile(50) <= 500 + 500 / 32);
+  REQUIRE(first.percentile(100) == 1000);
+
+  std::stringstream json;
+  first.write_json(json);
+  REQUIRE(json.str().find("\"count\": 1000") != std::string::npos);
+
+  // timers record per thread, snapshots merge all threads
+  using cuculiform::latency::Operation;
+  cuculiform::latency::reset();
+  cuculiform::latency::set_sample_interval(1);
+  bool relocated = false;
+  std::thread thread([&] {
+    cuculiform::latency::ScopedTimer timer(Operation::Contains);
+  });
+  thread.join();
+  {
+    cuculiform::latency::ScopedTimer timer(Operation::InsertDirect,
+                                           &relocated);
+    relocated = true;
+  }
+  { cuculiform::latency::ScopedTimer timer(Operation::InsertDirect); }
+  cuculiform::latency::set_sample_interval(0);
+  { cuculiform::latency::ScopedTimer timer(Operation::Erase); }
+  cuculiform::latency::Latencies latencies = cuculiform::latency::snapshot();
+  REQUIRE(latencies[Operation::Contains].count() == 1);
+  REQUIRE(latencies[Operation::InsertRelocated].count() == 1);
+  REQUIRE(latencies[Operation::InsertDirect].count() == 1);
+  REQUIRE(latencies[Operation::Erase].count() == 0);
+  cuculiform::latency::set_sample_interval(1);
+}
+
+TEST_CASE("filter views over caller memory", "[cuculiform][view]") {
+  size_t capacity = 1 << 12;
+  size_t fingerprint_size = 2;
+  cuculiform::CuckooFilter<uint64_t> filter{capacity, fingerprint_size};
+  for (uint64_t i = 0; i < capacity / 2; i++) {
+    REQUIRE(filter.insert(i));
+  }
+  std::vector<uint8_t> bytes;
+  filter.serialize(bytes, false);
+
+  const std::vector<uint8_t>& const_bytes = bytes;
+  cuculiform::CuckooFilterView<uint64_t> view{const_bytes.data(),
+                                              const_bytes.size()};
+  REQUIRE(view.size() == filter.size());
+  REQUIRE(view.fingerprint_size() == fingerprint_size);
+  size_t agreeing = 0;
+  for (uint64_t i = 0; i < capacity; i++) {
+    REQUIRE((i >= capacity / 2 || view.contains(i)));
+    agreeing += view.contains(i) == filter.contains(i);
+  }
+  REQUIRE(agreeing == capacity);
+
+  // a view inserts in place, the memory stays a serialized filter
+  std::vector<uint8_t> memory(
+    cuculiform::MutableCuckooFilterView<uint64_t>::required_size(
+      capacity, fingerprint_size));
+  cuculiform::MutableCuckooFilterView<uint64_t>::format(
+    memory.data(), capacity, fingerprint_size);
+  cuculiform::MutableCuckooFilterView<uint64_t> mutable_view{memory.data(),
+                                                             memory.size()};
+  for (uint64_t i = 0; i < capacity / 2; i++) {
+    REQUIRE(mutable_view.insert(i));
+  }
+  REQUIRE(mutable_view.erase(0));
+  REQUIRE(mutable_view.size() == capacity / 2 - 1);
+
+  cuculiform::CuckooFilter<uint64_t> loaded{capacity, fingerprint_size};
+  loaded.deserialize(memory.data(), memory.size());
+  REQUIRE(loaded.size() == capacity / 2 - 1);
+  for (uint64_t i = 1; i < capacity / 2; i++) {
+    REQUIRE(loaded.contains(i));
+  }
+
+  std::vector<uint8_t> compact;
+  filter.serialize(compact, true);
+  REQUIRE_THROWS_AS(
+    cuculiform::CuckooFilterView<uint64_t>(compact.data(), compact.size()),
+    const std::runtime_error&);
+  REQUIRE_THROWS_AS(
+    cuculiform::CuckooFilterView<uint64_t>(bytes.data(), bytes.size() - 1),
+    const std::runtime_error&);
+
+  // a crafted geometry whose payload size wraps around to 0
+  using cuculiform::serialization::put_le;
+  std::vector<uint8_t> wrapping(
+    bytes.begin(), bytes.begin() + cuculiform::FilterHeader::serialized_size);
+  wrapping[7] = 1;
+  put_le(wrapping.data() + 8, 4, 8);
+  put_le(wrapping.data() + 16, uint64_t(1) << 62, 8);
+  put_le(wrapping.data() + 24, UINT64_MAX, 8);
+  put_le(wrapping.data() + 32, 0, 8);
+  put_le(wrapping.data() + 40, 0, 8);
+  REQUIRE_THROWS_AS(
+    cuculiform::CuckooFilterView<uint64_t>(wrapping.data(), wrapping.size()),
+    const std::runtime_error&);
+  // more items than slots
+  std::vector<uint8_t> overfull = bytes;
+  put_le(overfull.data() + 32, capacity + 1, 8);
+  REQUIRE_THROWS_AS(
+    cuculiform::CuckooFilterView<uint64_t>(overfull.data(), overfull.size()),
+    const std::runtime_error&);
+}
+
+TEST_CASE("concurrent and shared memory filter", "[cuculiform][concurrent]") {
+  size_t capacity = 1 << 14;
+  size_t threads = 4;
+  cuculiform::ConcurrentCuckooFilter<uint64_t> filter{capacity, 2};
+  // fill to 90%, which needs relocations, while others look up
+  size_t per_thread = capacity * 9 / 10 / threads;
+  std::vector<std::thread> writers;
+  std::atomic<size_t> failed(0);
+  for (size_t t = 0; t < threads; t++) {
+    writers.emplace_back([&, t] {
+      for (uint64_t i = t * per_thread; i < (t + 1) * per_thread; i++) {
+        failed += !filter.insert(i);
+        // earlier items of this thread must stay visible throughout
+        failed += !filter.contains(t * per_thread + (i - t * per_thread) / 2);
+      }
+    });
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  REQUIRE(failed == 0);
+  REQUIRE(filter.size() == threads * per_thread);
+  for (uint64_t i = 0; i < threads * per_thread; i++) {
+    REQUIRE(filter.contains(i));
+  }
+  REQUIRE(filter.erase(0));
+  REQUIRE(filter.size() == threads * per_thread - 1);
+
+  // a second process attaches to the segment by name and inserts into it
+  std::string name = "/cuculiform-test-" + std::to_string(getpid());
+  cuculiform::ConcurrentCuckooFilter<uint64_t>::remove(name);
+  cuculiform::ConcurrentCuckooFilter<uint64_t> shared{name, capacity, 2};
+  pid_t child = fork();
+  if (child == 0) {
+    cuculiform::ConcurrentCuckooFilter<uint64_t> attached{name, capacity, 2};
+    bool ok = true;
+    for (uint64_t i = 0; i < capacity / 2; i += 2) {
+      ok = attached.insert(i) && ok;
+    }
+    _exit(ok ? 0 : 1);
+  }
+  for (uint64_t i = 1; i < capacity / 2; i += 2) {
+    REQUIRE(shared.insert(i));
+  }
+  int status = 0;
+  waitpid(child, &status, 0);
+  REQUIRE(WIFEXITED(status));
+  REQUIRE(WEXITSTATUS(status) == 0);
+  REQUIRE(shared.size() == capacity / 2);
+  for (uint64_t i = 0; i < capacity / 2; i++) {
+    REQUIRE(shared.contains(i));
+  }
+  REQUIRE_THROWS_AS((cuculiform::ConcurrentCuckooFilter<uint64_t>{
+                      name, capacity * 2, 2}),
+                    const std::runtime_error&);
+  cuculiform::ConcurrentCuckooFilter<uint64_t>::remove(name);
+}
+
+TEST_CASE("versioned filter", "[cuculiform][versioned]") {
+  using Filter = cuculiform::CuckooFilter<uint64_t>;
+  auto build = [](uint64_t version) {
+    std::unique_ptr<Filter> filter(new Filter(1 << 12, 2));
+    // 0 is in every version, version + 1000 only in its own
+    filter->insert(0);
+    filter->insert(version + 1000);
+    return std::unique_ptr<const Filter>(std::move(filter));
+  };
+  cuculiform::VersionedFilter<uint64_t> versioned(build(0));
+  REQUIRE(versioned.contains(1000));
+
+  std::atomic<bool> done(false);
+  std::atomic<size_t> misses(0);
+  std::vector<std::thread> readers;
+  for (size_t i = 0; i < 3; i++) {
+    readers.emplace_back([&] {
+      while (!done) {
+        misses += !versioned.contains(0);
+        // a snapshot holds exactly one version
+        misses += versioned.read([](const Filter& filter) {
+          return filter.size() != 2;
+        });
+      }
+    });
+  }
+  for (uint64_t version = 1; version <= 100; version++) {
+    versioned.publish(build(version));
+  }
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  REQUIRE(misses == 0);
+  REQUIRE(versioned.version() == 100);
+  REQUIRE(versioned.contains(1100));
+  REQUIRE(!versioned.contains(1000));
+}
+
+TEST_CASE("concurrent filter batches", "[cuculiform][concurrent][batch]") {
+  size_t capacity = 1 << 12;
+  cuculiform::ConcurrentCuckooFilter<uint64_t> filter{capacity, 4};
+  // batch k inserts 2k and 2k + 1, a reader never sees only one of them
+  size_t batches = capacity * 9 / 10 / 2;
+  std::atomic<bool> done(false);
+  std::atomic<size_t> torn(0);
+  std::thread reader([&] {
+    while (!done) {
+      for (uint64_t k = 0; k < batches; k++) {
+        torn += filter.contains(2 * k + 1) && !filter.contains(2 * k);
+      }
+    }
+  });
+  size_t failed = 0;
+  for (uint64_t k = 0; k < batches; k++) {
+    failed += !filter.apply_batch({2 * k, 2 * k + 1}, {});
+  }
+  done = true;
+  reader.join();
+  REQUIRE(failed == 0);
+  REQUIRE(torn == 0);
+  REQUIRE(filter.version() == batches);
+  REQUIRE(filter.size() == 2 * batches);
+  for (uint64_t i = 0; i < 2 * batches; i++) {
+    REQUIRE(filter.contains(i));
+  }
+
+  // erases come first, so a batch can replace items in a full filter
+  std::vector<uint64_t> old_items;
+  std::vector<uint64_t> new_items;
+  for (uint64_t i = 0; i < 64; i++) {
+    old_items.push_back(i);
+    new_items.push_back(capacity + i);
+  }
+  REQUIRE(filter.apply_batch(new_items, old_items));
+  REQUIRE(filter.size() == 2 * batches);
+  REQUIRE(filter.contains(capacity));
+  REQUIRE(!filter.contains(0));
+
+  // a batch that needs relocations never hides the items already there
+  cuculiform::ConcurrentCuckooFilter<uint64_t> loaded{capacity, 4};
+  for (uint64_t i = 0; i < capacity / 2; i++) {
+    REQUIRE(loaded.insert(i));
+  }
+  std::vector<uint64_t> rest;
+  for (uint64_t i = capacity / 2; i < capacity * 9 / 10; i++) {
+    rest.push_back(i);
+  }
+  done = false;
+  std::atomic<size_t> missed(0);
+  std::thread checker([&] {
+    while (!done) {
+      for (uint64_t i = 0; i < capacity / 2; i++) {
+        missed += !loaded.contains(i);
+      }
+    }
+  });
+  REQUIRE(loaded.apply_batch(rest, {}));
+  done = true;
+  checker.join();
+  REQUIRE(missed == 0);
+  REQUIRE(loaded.version() == 1);
+  REQUIRE(loaded.size() == capacity * 9 / 10);
+  for (uint64_t i = 0; i < capacity * 9 / 10; i++) {
+    REQUIRE(loaded.contains(i));
+  }
+
+  // a batch that doesn't fit changes nothing
+  cuculiform::ConcurrentCuckooFilter<uint64_t> tiny{8, 4};
+  REQUIRE(tiny.apply_batch({1, 2, 3, 4}, {}));
+  std::vector<uint64_t> too_many;
+  for (uint64_t i = 100; i < 120; i++) {
+    too_many.push_back(i);
+  }
+  REQUIRE(!tiny.apply_batch(too_many, {1, 2}));
+  REQUIRE(tiny.size() == 4);
+  REQUIRE(tiny.version() == 1);
+  for (uint64_t i = 1; i <= 4; i++) {
+    REQUIRE(tiny.contains(i));
+  }
+  for (uint64_t i = 100; i < 120; i++) {
+    REQUIRE(!tiny.contains(i));
+  }
+}
+
+TEST_CASE("incremental checkpoints", "[cuculiform][checkpoint]") {
+  size_t capacity = 1 << 20;
+  cuculiform::CuckooFilter<uint64_t> filter{capacity, 2};
+  for (uint64_t i = 0; i < capacity / 2; i++) {
+    filter.insert(i);
+  }
+  REQUIRE_THROWS_AS(
+    [&] {
+      std::stringstream unused;
+      filter.checkpoint_delta(unused);
+    }(),
+    const std::runtime_error&);
+  std::stringstream log;
+  size_t base = filter.checkpoint(log);
+  REQUIRE(base > capacity);
+
+  // deltas hold only the blocks touched since, nothing if none were
+  for (uint64_t i = capacity; i < capacity + 10; i++) {
+    REQUIRE(filter.insert(i));
+  }
+  size_t delta = filter.checkpoint_delta(log);
+  REQUIRE(delta < base / 16);
+  size_t header_size = cuculiform::FilterHeader::serialized_size;
+  REQUIRE(filter.checkpoint_delta(log) == header_size);
+  for (uint64_t i = 0; i < 100; i++) {
+    REQUIRE(filter.erase(i));
+  }
+  // a delta that couldn't be written leaves its blocks to the next one
+  std::stringstream failing;
+  failing.setstate(std::ios::badbit);
+  REQUIRE_THROWS_AS(filter.checkpoint_delta(failing),
+                    const std::runtime_error&);
+  REQUIRE(filter.checkpoint_delta(log) > header_size);
+
+  auto bytes = [](const cuculiform::CuckooFilter<uint64_t>& filter) {
+    std::vector<uint8_t> out;
+    filter.serialize(out, false);
+    return out;
+  };
+  cuculiform::CuckooFilter<uint64_t> restored{capacity, 2};
+  restored.restore(log);
+  REQUIRE(restored.size() == filter.size());
+  REQUIRE(bytes(restored) == bytes(filter));
+  REQUIRE(restored.contains(capacity));
+  REQUIRE(restored.contains(100));
+
+  // the restored filter keeps appending to the log, which replays alike
+  restored.erase(capacity);
+  log.clear();
+  restored.checkpoint_delta(log);
+  log.seekg(0);
+  cuculiform::CuckooFilter<uint64_t> replayed{capacity, 2};
+  replayed.restore(log);
+  REQUIRE(bytes(replayed) == bytes(restored));
+  REQUIRE(!replayed.contains(capacity));
+
+  // the log only loads into filters of its geometry
+  cuculiform::CuckooFilter<uint64_t> other{capacity * 2, 2};
+  log.clear();
+  log.seekg(0);
+  REQUIRE_THROWS_AS(other.restore(log), const std::runtime_error&);
+
+  // and only if it starts with a checkpoint
+  std::stringstream deltas;
+  filter.checkpoint_delta(deltas);
+  REQUIRE_THROWS_AS(replayed.restore(deltas), const std::runtime_error&);
+}
+
+TEST_CASE("diff and patch", "[cuculiform][diff]") {
+  size_t capacity = 1 << 16;
+  using Filter = cuculiform::CuckooFilter<uint64_t>;
+  Filter master{capacity, 2};
+  for (uint64_t i = 0; i < capacity / 2; i++) {
+    master.insert(i);
+  }
+  Filter replica{master};
+  auto bytes = [](const Filter& filter) {
+    std::vector<uint8_t> out;
+    filter.serialize(out, false);
+    return out;
+  };
+  size_t header_size = cuculiform::FilterHeader::serialized_size;
+  REQUIRE(master.diff(replica).size() == header_size);
+
+  for (uint64_t i = capacity; i < capacity + 50; i++) {
+    master.insert(i);
+  }
+  for (uint64_t i = 0; i < 50; i++) {
+    master.erase(i);
+  }
+  // at most a few kicked buckets besides the ones inserted to or erased from
+  std::vector<uint8_t> diff = master.diff(replica);
+  size_t bucket_bytes = 4 * 2;
+  REQUIRE(diff.size() < header_size + 200 * (bucket_bytes + 2));
+  replica.patch(diff);
+  REQUIRE(bytes(replica) == bytes(master));
+  REQUIRE(replica.size() == master.size());
+  REQUIRE(replica.contains(capacity));
+
+  std::vector<uint8_t> full = bytes(master);
+  REQUIRE_THROWS_AS(replica.patch(full), const std::runtime_error&);
+  Filter other{capacity * 2, 2};
+  REQUIRE_THROWS_AS(other.patch(diff), const std::runtime_error&);
+  REQUIRE_THROWS_AS(master.diff(other), const std::runtime_error&);
+
+  // patching a replica that tracks checkpoints marks only the patched
+  // blocks dirty
+  Filter tracked{master};
+  std::stringstream log;
+  size_t base = tracked.checkpoint(log);
+  master.insert(capacity + 100);
+  tracked.patch(master.diff(tracked));
+  REQUIRE(tracked.checkpoint_delta(log) < base / 4);
+}
+
+TEST_CASE("intersection and similarity estimates", "[cuculiform][similarity]") {
+  size_t capacity = 1 << 16;
+  uint64_t items = 40000;
+  for (size_t fingerprint_size : {1, 2}) {
+    cuculiform::CuckooFilter<uint64_t> a{capacity, fingerprint_size};
+    cuculiform::CuckooFilter<uint64_t> b{capacity, fingerprint_size};
+    cuculiform::CuckooFilter<uint64_t> c{capacity, fingerprint_size};
+    for (uint64_t i = 0; i < items; i++) {
+      a.insert(i);
+      b.insert(i + items / 2);
+      c.insert(i + items * 2);
+    }
+    // a and b share half of their items, a and c none
+    REQUIRE(std::abs(cuculiform::estimate_intersection(a, b) - items / 2)
+            < items / 50);
+    REQUIRE(std::abs(cuculiform::estimate_jaccard(a, b) - 1.0 / 3) < 0.01);
+    REQUIRE(cuculiform::estimate_intersection(a, c) < items / 100);
+    REQUIRE(std::abs(cuculiform::estimate_jaccard(a, a) - 1) < 0.01);
+  }
+  cuculiform::CuckooFilter<uint64_t> other{capacity * 2, 2};
+  cuculiform::CuckooFilter<uint64_t> empty{capacity, 2};
+  REQUIRE(cuculiform::estimate_jaccard(empty, empty) == 0);
+  REQUIRE_THROWS_AS(cuculiform::estimate_intersection(empty, other),
+                    const std::runtime_error&);
+}
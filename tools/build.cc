@@ -0,0 +1,144 @@
+#include "cuculiform.h"
+#include "keys.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+
+static void usage() {
+  std::cerr
+    << "usage: cuculiform-build [options] -o FILTER [KEYS]\n"
+       "Build a filter from the keys in KEYS, or stdin if missing or -.\n"
+       "  -o FILTER  file to write the serialized filter to\n"
+       "  -c N       capacity, defaults to the key count of a KEYS file\n"
+       "             divided by the target load of 0.95, required for stdin\n"
+       "  -f N       fingerprint size in bytes, 1 to 4, defaults to 2\n"
+       "  -w N       keys are binary records of N bytes instead of lines\n"
+       "  -r         write the raw instead of the compact format\n";
+}
+
+// count the keys of a mapped input like KeyParser would cut it
+static size_t count_keys(const tools::MappedFile& file, size_t width) {
+  if (width > 0) {
+    return file.size() / width;
+  }
+  size_t lines = 0;
+  const uint8_t* end = file.data() + file.size();
+  for (const uint8_t* line = file.data(); line < end;) {
+    auto newline =
+      static_cast<const uint8_t*>(memchr(line, '\n', end - line));
+    const uint8_t* line_end = newline == nullptr ? end : newline;
+    // empty lines, also with a carriage return only, are skipped
+    size_t length = line_end - line;
+    if (length > 0 && line[length - 1] == '\r') {
+      length--;
+    }
+    lines += length > 0;
+    line = newline == nullptr ? end : newline + 1;
+  }
+  return lines;
+}
+
+int main(int argc, char** argv) {
+  std::string output;
+  size_t capacity = 0;
+  size_t fingerprint_size = 2;
+  size_t width = 0;
+  bool compact = true;
+  int option;
+  while ((option = getopt(argc, argv, "o:c:f:w:r")) != -1) {
+    switch (option) {
+      case 'o':
+        output = optarg;
+        break;
+      case 'c':
+        capacity = std::strtoull(optarg, nullptr, 10);
+        break;
+      case 'f':
+        fingerprint_size = std::strtoull(optarg, nullptr, 10);
+        break;
+      case 'w':
+        width = std::strtoull(optarg, nullptr, 10);
+        break;
+      case 'r':
+        compact = false;
+        break;
+      default:
+        usage();
+        return EXIT_FAILURE;
+    }
+  }
+  std::string path = optind < argc ? argv[optind] : "-";
+  if (output.empty() || fingerprint_size < 1 || fingerprint_size > 4) {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  try {
+    tools::Input input(path);
+    if (capacity == 0) {
+      if (input.file() == nullptr) {
+        std::cerr << "cuculiform-build: -c is required for stdin" << std::endl;
+        return EXIT_FAILURE;
+      }
+      capacity = count_keys(*input.file(), width) * 100 / 95 + 1;
+    }
+    cuculiform::CuckooFilter<uint64_t> filter{capacity, fingerprint_size};
+
+    auto start = Clock::now();
+    tools::BatchQueue queue(64);
+    std::exception_ptr error;
+    std::thread parser(tools::parse_input, std::cref(input), width,
+                       std::ref(queue), std::ref(error));
+    size_t keys = 0;
+    size_t bytes = 0;
+    size_t failed = 0;
+    tools::KeyBatch batch;
+    while (queue.pop(batch)) {
+      for (uint64_t hash : batch.hashes) {
+        failed += !filter.insert(hash);
+      }
+      keys += batch.keys.size();
+      bytes += batch.bytes;
+    }
+    parser.join();
+    if (error) {
+      std::rethrow_exception(error);
+    }
+    double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::ofstream file(output, std::ios::binary);
+    filter.serialize(file, compact);
+    if (!file) {
+      throw std::runtime_error("can't write " + output);
+    }
+
+    // key hashes are the filter's items, so random 64 bit values are
+    // non-members with overwhelming probability
+    std::mt19937_64 gen(std::random_device{}());
+    size_t probes = 1000000;
+    size_t false_positives = 0;
+    for (size_t i = 0; i < probes; i++) {
+      false_positives += filter.contains(gen());
+    }
+
+    std::cerr << keys << " keys in " << seconds << "s, "
+              << keys / seconds / 1e6 << "M keys/s, "
+              << bytes / seconds / 1e6 << "MB/s\n"
+              << failed << " failed inserts, load " << filter.load_factor()
+              << ", measured fpr "
+              << static_cast<double>(false_positives) / probes << "\n"
+              << "wrote " << file.tellp() << " bytes to " << output
+              << std::endl;
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  } catch (const std::exception& exception) {
+    std::cerr << "cuculiform-build: " << exception.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+}
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "city.h"
+
+// Key input shared by the command line tools. Keys are read from a file,
+// which is mapped, or from stdin, either newline-delimited or as records of
+// a fixed width. A parser thread cuts the input into batches of keys and
+// hands them to the consuming thread through a bounded queue.
+
+namespace tools {
+
+// Read-only mapping of a whole file
+class MappedFile {
+public:
+  explicit MappedFile(const std::string& path) : m_data(nullptr), m_size(0) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("can't open " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+      close(fd);
+      throw std::runtime_error("can't stat " + path);
+    }
+    m_size = static_cast<size_t>(info.st_size);
+    if (m_size > 0) {
+      void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("can't map " + path);
+      }
+      // keys are read front to back
+      madvise(data, m_size, MADV_SEQUENTIAL);
+      m_data = static_cast<const uint8_t*>(data);
+    }
+    close(fd);
+  }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile() {
+    if (m_data != nullptr) {
+      munmap(const_cast<uint8_t*>(m_data), m_size);
+    }
+  }
+
+  const uint8_t* data() const {
+    return m_data;
+  }
+  size_t size() const {
+    return m_size;
+  }
+
+private:
+  const uint8_t* m_data;
+  size_t m_size;
+};
+
+// 64 bit hash of a key's bytes, the item type of the tools' filters
+inline uint64_t hash_key(const uint8_t* key, size_t length) {
+  return CityHash64(reinterpret_cast<const char*>(key), length);
+}
+
+struct KeyBatch {
+  // key bytes read from a stream, mapped input is referenced in place
+  std::vector<uint8_t> buffer;
+  std::vector<std::pair<const uint8_t*, size_t>> keys;
+  std::vector<uint64_t> hashes;
+  size_t bytes = 0; // input bytes covered, including delimiters
+};
+
+// Bounded single-producer single-consumer queue of batches
+class BatchQueue {
+public:
+  explicit BatchQueue(size_t capacity) : m_capacity(capacity), m_closed(false) {
+  }
+
+  void push(KeyBatch&& batch) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_not_full.wait(lock, [this] { return m_batches.size() < m_capacity; });
+    m_batches.push_back(std::move(batch));
+    m_not_empty.notify_one();
+  }
+  // no more batches will be pushed
+  void close() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closed = true;
+    m_not_empty.notify_one();
+  }
+  // false once the queue is closed and drained
+  bool pop(KeyBatch& batch) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_not_empty.wait(lock, [this] { return !m_batches.empty() || m_closed; });
+    if (m_batches.empty()) {
+      return false;
+    }
+    batch = std::move(m_batches.front());
+    m_batches.pop_front();
+    m_not_full.notify_one();
+    return true;
+  }
+
+private:
+  const size_t m_capacity;
+  bool m_closed;
+  std::deque<KeyBatch> m_batches;
+  std::mutex m_mutex;
+  std::condition_variable m_not_full;
+  std::condition_variable m_not_empty;
+};
+
+// Cuts the input into keys. width 0 means newline-delimited keys, where
+// empty lines are skipped and a trailing carriage return is dropped.
+class KeyParser {
+public:
+  static constexpr size_t keys_per_batch = 4096;
+
+  KeyParser(size_t width, BatchQueue& queue) : m_width(width), m_queue(queue) {
+  }
+
+  // parse a mapped input, keys reference the mapping
+  void parse(const uint8_t* data, size_t size) {
+    KeyBatch batch;
+    size_t consumed = parse_keys(data, size, batch);
+    // a last line without newline
+    if (m_width == 0 && consumed < size) {
+      add_key(data + consumed, size - consumed, batch);
+      batch.bytes += size - consumed;
+    }
+    flush(batch);
+  }
+
+  // parse a stream read chunk by chunk, keys are copied into the batches
+  void parse(int fd) {
+    size_t chunk_size = size_t(1) << 20;
+    std::vector<uint8_t> pending; // incomplete key at the end of a chunk
+    for (;;) {
+      KeyBatch batch;
+      batch.buffer.swap(pending);
+      size_t carried = batch.buffer.size();
+      batch.buffer.resize(carried + chunk_size);
+      ssize_t bytes = read(fd, batch.buffer.data() + carried, chunk_size);
+      if (bytes < 0) {
+        throw std::runtime_error("can't read input");
+      }
+      batch.buffer.resize(carried + bytes);
+      if (bytes == 0) {
+        if (m_width == 0 && !batch.buffer.empty()) {
+          add_key(batch.buffer.data(), batch.buffer.size(), batch);
+          batch.bytes += batch.buffer.size();
+        }
+        flush(batch);
+        return;
+      }
+      // the buffer isn't resized after this, so keys may point into it
+      size_t consumed =
+        parse_keys(batch.buffer.data(), batch.buffer.size(), batch);
+      pending.assign(batch.buffer.begin() + consumed, batch.buffer.end());
+      flush(batch);
+    }
+  }
+
+private:
+  const size_t m_width;
+  BatchQueue& m_queue;
+
+  void add_key(const uint8_t* key, size_t length, KeyBatch& batch) {
+    if (m_width == 0 && length > 0 && key[length - 1] == '\r') {
+      length--;
+    }
+    if (length == 0) {
+      return;
+    }
+    batch.keys.emplace_back(key, length);
+    batch.hashes.push_back(hash_key(key, length));
+  }
+
+  void flush(KeyBatch& batch) {
+    if (!batch.keys.empty() || batch.bytes > 0) {
+      m_queue.push(std::move(batch));
+    }
+    batch = KeyBatch();
+  }
+
+  // Parse all complete keys of [data, data + size) into batches, the last of
+  // which is left in batch. Returns the number of bytes consumed. Batches
+  // referencing a stream buffer are kept whole, as they own the buffer.
+  size_t parse_keys(const uint8_t* data, size_t size, KeyBatch& batch) {
+    bool owns_buffer = !batch.buffer.empty();
+    size_t position = 0;
+    while (position < size) {
+      const uint8_t* key = data + position;
+      size_t length;
+      if (m_width > 0) {
+        if (size - position < m_width) {
+          break;
+        }
+        length = m_width;
+        position += m_width;
+      } else {
+        auto newline = static_cast<const uint8_t*>(
+          memchr(key, '\n', size - position));
+        if (newline == nullptr) {
+          break;
+        }
+        length = newline - key;
+        position += length + 1;
+      }
+      batch.bytes += position - (key - data);
+      add_key(key, length, batch);
+      if (!owns_buffer && batch.keys.size() == keys_per_batch) {
+        flush(batch);
+      }
+    }
+    return position;
+  }
+};
+
+// A file to map or stdin for "-"
+class Input {
+public:
+  explicit Input(const std::string& path)
+      : m_file(path == "-" ? nullptr : new MappedFile(path)) {
+  }
+
+  const MappedFile* file() const {
+    return m_file.get();
+  }
+
+private:
+  std::unique_ptr<MappedFile> m_file;
+};
+
+// Parse input into queue and close it, meant to run on a thread of its own.
+// Errors are handed over in error, input has to outlive all batches.
+inline void parse_input(const Input& input, size_t width, BatchQueue& queue,
+                        std::exception_ptr& error) {
+  try {
+    KeyParser parser(width, queue);
+    if (input.file() == nullptr) {
+      parser.parse(STDIN_FILENO);
+    } else {
+      parser.parse(input.file()->data(), input.file()->size());
+    }
+  } catch (...) {
+    error = std::current_exception();
+  }
+  queue.close();
+}
+
+} // namespace tools
@@ -0,0 +1,131 @@
+#include "cuckoo_filter_view.h"
+#include "cuculiform.h"
+#include "keys.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+
+static void usage() {
+  std::cerr
+    << "usage: cuculiform-query [options] FILTER [KEYS]\n"
+       "Write the keys in KEYS, or stdin if missing or -, that are contained\n"
+       "in FILTER to stdout.\n"
+       "  -v    write the keys that are not contained instead\n"
+       "  -n    only count, don't write keys\n"
+       "  -w N  keys are binary records of N bytes instead of lines\n";
+}
+
+// Filter the keys of path through filter, either a CuckooFilter or a view
+template <typename Filter>
+static void query(const Filter& filter, const cuculiform::FilterHeader& header,
+                  const std::string& path, size_t width, bool invert,
+                  bool count_only) {
+  tools::Input input(path);
+  auto start = Clock::now();
+  tools::BatchQueue queue(64);
+  std::exception_ptr error;
+  std::thread parser(tools::parse_input, std::cref(input), width,
+                     std::ref(queue), std::ref(error));
+  size_t keys = 0;
+  size_t bytes = 0;
+  size_t contained = 0;
+  tools::KeyBatch batch;
+  // static, as stdout keeps using the buffer until it is flushed at exit
+  static char out[1 << 20];
+  setvbuf(stdout, out, _IOFBF, sizeof(out));
+  while (queue.pop(batch)) {
+    for (size_t i = 0; i < batch.keys.size(); i++) {
+      bool found = filter.contains(batch.hashes[i]);
+      contained += found;
+      if (found != invert && !count_only) {
+        fwrite(batch.keys[i].first, 1, batch.keys[i].second, stdout);
+        if (width == 0) {
+          fputc('\n', stdout);
+        }
+      }
+    }
+    keys += batch.keys.size();
+    bytes += batch.bytes;
+  }
+  parser.join();
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  fflush(stdout);
+  double seconds =
+    std::chrono::duration<double>(Clock::now() - start).count();
+
+  // a lookup compares against 2 * bucket_size fingerprints
+  double expected_fpr =
+    1 - std::pow(1 - 1 / std::pow(2.0, 8 * header.fingerprint_size),
+                 2 * header.bucket_size * filter.load_factor());
+  std::cerr << keys << " keys in " << seconds << "s, "
+            << keys / seconds / 1e6 << "M keys/s, "
+            << bytes / seconds / 1e6 << "MB/s\n"
+            << contained << " contained, filter load "
+            << filter.load_factor() << ", expected fpr " << expected_fpr
+            << std::endl;
+}
+
+int main(int argc, char** argv) {
+  bool invert = false;
+  bool count_only = false;
+  size_t width = 0;
+  int option;
+  while ((option = getopt(argc, argv, "vnw:")) != -1) {
+    switch (option) {
+      case 'v':
+        invert = true;
+        break;
+      case 'n':
+        count_only = true;
+        break;
+      case 'w':
+        width = std::strtoull(optarg, nullptr, 10);
+        break;
+      default:
+        usage();
+        return EXIT_FAILURE;
+    }
+  }
+  if (optind >= argc) {
+    usage();
+    return EXIT_FAILURE;
+  }
+  std::string filter_path = argv[optind];
+  std::string path = optind + 1 < argc ? argv[optind + 1] : "-";
+
+  try {
+    // the header tells the geometry to construct the filter with
+    tools::MappedFile filter_file(filter_path);
+    if (filter_file.size() < cuculiform::FilterHeader::serialized_size) {
+      throw std::runtime_error("truncated filter file " + filter_path);
+    }
+    cuculiform::FilterHeader header =
+      cuculiform::serialization::decode_header(filter_file.data());
+    if (header.format == cuculiform::SerializationFormat::Delta) {
+      throw std::runtime_error("filter file holds a delta, not a filter");
+    }
+    if (header.format == cuculiform::SerializationFormat::Raw) {
+      // raw filters are queried in place, without loading them
+      cuculiform::CuckooFilterView<uint64_t> view{filter_file.data(),
+                                                  filter_file.size()};
+      query(view, header, path, width, invert, count_only);
+    } else {
+      cuculiform::CuckooFilter<uint64_t> filter{
+        header.capacity, header.fingerprint_size, 500, header.bucket_size};
+      filter.deserialize(filter_file.data(), filter_file.size());
+      query(filter, header, path, width, invert, count_only);
+    }
+    return EXIT_SUCCESS;
+  } catch (const std::exception& exception) {
+    std::cerr << "cuculiform-query: " << exception.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+}